@@ -0,0 +1,284 @@
+/* See LICENSE for license details. */
+/*
+ * Times the CPU heavy kernels of the image pipeline on synthetic inputs of a
+ * few sizes: base64 decoding, pixel conversion, inflating, alpha
+ * premultiplication, the scaling done when loading a pixmap, and the eviction
+ * done by gr_check_limits() with thousands of images.
+ *
+ * usage: bench/graphics
+ */
+#include "../graphics.c"
+
+#include <zlib.h>
+
+#define MINTIME	0.2 /* seconds spent on each measure */
+#define LEN(a)	(sizeof(a) / sizeof(a)[0])
+
+static void die(const char *);
+static double now(void);
+static void report(const char *, const char *, double, double, const char *);
+static unsigned char *randbytes(size_t, int);
+static char *base64enc(const unsigned char *, size_t);
+static void benchbase64(size_t);
+static void benchcopy(int, int);
+static void benchinflate(int, int);
+static void benchpremultiply(int);
+static void benchscale(int, int);
+static void benchlimits(int);
+
+/* config.h globals */
+const char graphics_cache_dir_template[] = "/tmp/st-images-XXXXXX";
+unsigned graphics_max_single_image_file_size = 20 * 1024 * 1024;
+unsigned graphics_total_file_cache_size = 300 * 1024 * 1024;
+unsigned graphics_max_single_image_ram_size = 100 * 1024 * 1024;
+unsigned graphics_max_total_ram_size = 300 * 1024 * 1024;
+unsigned graphics_max_total_placements = 4096;
+double graphics_excess_tolerance_ratio = 0.05;
+unsigned graphics_animation_min_delay = 20;
+
+void
+die(const char *msg)
+{
+	fputs(msg, stderr);
+	exit(1);
+}
+
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+void
+report(const char *kernel, const char *size, double amount, double t,
+       const char *unit)
+{
+	printf("%-34s %12s %12.1f %s\n", kernel, size, amount / t, unit);
+}
+
+/* noise, or smooth gradients when compressible, as in screenshots */
+unsigned char *
+randbytes(size_t len, int compressible)
+{
+	unsigned char *p = malloc(len);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = compressible ? (i / 4 + (i % 4) * 64) / 16 : rand();
+	return p;
+}
+
+char *
+base64enc(const unsigned char *p, size_t len)
+{
+	static const char tab[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	char *s = malloc((len + 2) / 3 * 4 + 1), *q = s;
+	unsigned long v;
+	size_t i;
+
+	for (i = 0; i < len; i += 3) {
+		v = p[i] << 16 | (i + 1 < len ? p[i + 1] << 8 : 0) |
+		    (i + 2 < len ? p[i + 2] : 0);
+		*q++ = tab[v >> 18 & 63];
+		*q++ = tab[v >> 12 & 63];
+		*q++ = i + 1 < len ? tab[v >> 6 & 63] : '=';
+		*q++ = i + 2 < len ? tab[v & 63] : '=';
+	}
+	*q = '\0';
+	return s;
+}
+
+void
+benchbase64(size_t len)
+{
+	unsigned char *p = randbytes(len, 0);
+	char *s = base64enc(p, len), *d, size[32];
+	size_t n;
+	double t0, t;
+	int i;
+
+	for (i = 0, t0 = now(); (t = now() - t0) < MINTIME; i++) {
+		d = gr_base64dec(s, &n);
+		free(d);
+	}
+	snprintf(size, sizeof(size), "%zu KiB", len / 1024);
+	report("gr_base64dec", size, (double)strlen(s) * i / 1E6, t, "MB/s");
+	free(s);
+	free(p);
+}
+
+void
+benchcopy(int w, int format)
+{
+	size_t npix = (size_t)w * w;
+	unsigned char *p = randbytes(npix * format / 8, 0);
+	DATA32 *d = malloc(npix * sizeof(DATA32));
+	char size[32];
+	double t0, t;
+	int i;
+
+	for (i = 0, t0 = now(); (t = now() - t0) < MINTIME; i++)
+		gr_copy_pixels(d, p, format, npix);
+	snprintf(size, sizeof(size), "%dx%d/%d", w, w, format);
+	report("gr_copy_pixels", size, (double)npix * i / 1E6, t, "Mpix/s");
+	free(d);
+	free(p);
+}
+
+void
+benchinflate(int w, int format)
+{
+	size_t npix = (size_t)w * w, len = npix * format / 8;
+	unsigned char *p = randbytes(len, 1), *z;
+	DATA32 *d = malloc(npix * sizeof(DATA32));
+	uLongf zlen = compressBound(len);
+	FILE *f = tmpfile();
+	char size[32];
+	double t0, t;
+	int i;
+
+	z = malloc(zlen);
+	if (!f || compress(z, &zlen, p, len) != Z_OK)
+		die("cannot prepare compressed data\n");
+	fwrite(z, 1, zlen, f);
+	for (i = 0, t0 = now(); (t = now() - t0) < MINTIME; i++) {
+		rewind(f);
+		if (gr_load_raw_pixel_data_compressed(d, f, format, npix))
+			die("cannot inflate\n");
+	}
+	snprintf(size, sizeof(size), "%dx%d/%d", w, w, format);
+	report("gr_load_raw_pixel_data_compressed", size,
+	       (double)npix * i / 1E6, t, "Mpix/s");
+	fclose(f);
+	free(z);
+	free(d);
+	free(p);
+}
+
+void
+benchpremultiply(int w)
+{
+	size_t npix = (size_t)w * w;
+	DATA32 *src = (DATA32 *)randbytes(npix * sizeof(DATA32), 0);
+	DATA32 *d = malloc(npix * sizeof(DATA32));
+	char size[32];
+	double t0, t, spent = 0;
+	int i;
+
+	/* the data is premultiplied in place, so start each run afresh */
+	for (i = 0, t0 = now(); now() - t0 < MINTIME; i++) {
+		memcpy(d, src, npix * sizeof(DATA32));
+		t = now();
+		gr_premultiply_alpha(d, npix);
+		spent += now() - t;
+	}
+	snprintf(size, sizeof(size), "%dx%d", w, w);
+	report("gr_premultiply_alpha", size, (double)npix * i / 1E6, spent,
+	       "Mpix/s");
+	free(d);
+	free(src);
+}
+
+/* the blend of gr_load_pixmap(), from a w x w image into a box of size s */
+void
+benchscale(int w, int s)
+{
+	Imlib_Image src, dst;
+	DATA32 *data;
+	unsigned char *p = randbytes((size_t)w * w * 4, 0);
+	char size[32];
+	double t0, t;
+	int i;
+
+	src = imlib_create_image(w, w);
+	dst = imlib_create_image(s, s);
+	if (!src || !dst)
+		die("imlib_create_image failed\n");
+	imlib_context_set_image(src);
+	imlib_image_set_has_alpha(1);
+	data = imlib_image_get_data();
+	memcpy(data, p, (size_t)w * w * 4);
+	imlib_image_put_back_data(data);
+	free(p);
+
+	imlib_context_set_image(dst);
+	imlib_image_set_has_alpha(1);
+	imlib_context_set_anti_alias(1);
+	for (i = 0, t0 = now(); (t = now() - t0) < MINTIME; i++) {
+		imlib_context_set_blend(0);
+		imlib_context_set_color(0, 0, 0, 0);
+		imlib_image_fill_rectangle(0, 0, s, s);
+		imlib_context_set_blend(1);
+		imlib_blend_image_onto_image(src, 1, 0, 0, w, w, 0, 0, s, s);
+	}
+	snprintf(size, sizeof(size), "%d->%d", w, s);
+	report("scale (gr_load_pixmap)", size, (double)s * s * i / 1E6, t,
+	       "Mpix/s");
+	imlib_free_image();
+	imlib_context_set_image(src);
+	imlib_free_image();
+}
+
+/* one image over the limit at a time, so that every call evicts */
+void
+benchlimits(int n)
+{
+	Image *img;
+	char size[32];
+	double t0, t;
+	int i;
+
+	gr_delete_all_images();
+	graphics_max_total_placements = n;
+	graphics_excess_tolerance_ratio = 0;
+	for (i = 1; i <= n; i++)
+		gr_new_placement(gr_new_image(i), 1);
+	for (t0 = now(); (t = now() - t0) < MINTIME; i++) {
+		img = gr_new_image(i);
+		gr_new_placement(img, 1);
+		gr_check_limits();
+	}
+	snprintf(size, sizeof(size), "%d images", n);
+	report("gr_check_limits", size, (i - n - 1) / 1E3, t, "kcalls/s");
+	gr_delete_all_images();
+}
+
+int
+main(void)
+{
+	static const int dims[] = { 64, 512, 2048 };
+	int i;
+
+	srand(1);
+	gr_init(NULL, NULL, 0);
+	if (!gr_load_libs())
+		die("cannot load Imlib2 and zlib\n");
+	printf("%-34s %12s %12s\n", "kernel", "size", "throughput");
+	for (i = 0; i < LEN(dims); i++)
+		benchbase64((size_t)dims[i] * dims[i] * 4);
+	for (i = 0; i < LEN(dims); i++) {
+		benchcopy(dims[i], 24);
+		benchcopy(dims[i], 32);
+	}
+	for (i = 0; i < LEN(dims); i++)
+		benchinflate(dims[i], 32);
+	for (i = 0; i < LEN(dims); i++)
+		benchpremultiply(dims[i]);
+	benchscale(2048, 640);
+	benchscale(512, 640);
+	benchscale(64, 640);
+	benchlimits(1000);
+	benchlimits(4000);
+	benchlimits(16000);
+
+	return 0;
+}
+
+/* There is no terminal */
+void gr_for_each_image_cell(int (*callback)(void *, uint32_t, uint32_t, int,
+                            int, char), void *data) {}
+void gr_schedule_image_redraw_by_id(uint32_t image_id) {}
@@ -0,0 +1,218 @@
+/* See LICENSE for license details. */
+/*
+ * Runs a command on a pty and holds what goes through it in both directions
+ * for the given ms, as a slow link would, to try the predictive local echo
+ * (predicttimeout in config.h) without one:
+ *
+ *	st -e bench/lag 300 sh
+ *
+ * usage: bench/lag ms [command ...]
+ */
+#include <errno.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHUNK	4096
+#define MAX(a, b)	((a) < (b) ? (b) : (a))
+
+typedef struct Chunk Chunk;
+struct Chunk {
+	char buf[CHUNK];
+	size_t len, off;
+	double due;
+	Chunk *next;
+};
+
+typedef struct {
+	int in, out;
+	Chunk *head, *tail;
+} Pipe;
+
+static double now(void);
+static void die(const char *, ...);
+static void sigwinch(int);
+static int pull(Pipe *);
+static void push(Pipe *);
+static void cleanup(void);
+
+static struct termios orig;
+static volatile sig_atomic_t resized;
+static double delay;
+
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
+}
+
+void
+sigwinch(int unused)
+{
+	resized = 1;
+}
+
+void
+cleanup(void)
+{
+	tcsetattr(0, TCSANOW, &orig);
+}
+
+/* Queues what can be read, due delay from now. Returns 0 at end of file. */
+int
+pull(Pipe *p)
+{
+	Chunk *c;
+	ssize_t n;
+
+	if (!(c = malloc(sizeof(*c))))
+		die("malloc: %s\n", strerror(errno));
+	if ((n = read(p->in, c->buf, sizeof(c->buf))) <= 0) {
+		free(c);
+		return n < 0 && errno == EINTR;
+	}
+	c->len = n;
+	c->off = 0;
+	c->due = now() + delay;
+	c->next = NULL;
+	if (p->tail)
+		p->tail->next = c;
+	else
+		p->head = c;
+	p->tail = c;
+	return 1;
+}
+
+/* Writes what is due */
+void
+push(Pipe *p)
+{
+	Chunk *c;
+	ssize_t n;
+
+	while ((c = p->head) && c->due <= now()) {
+		if ((n = write(p->out, c->buf + c->off, c->len - c->off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("write: %s\n", strerror(errno));
+		}
+		if ((c->off += n) < c->len)
+			return;
+		if (!(p->head = c->next))
+			p->tail = NULL;
+		free(c);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	static char *sh[] = { "/bin/sh", NULL };
+	struct termios raw;
+	struct winsize ws;
+	struct timeval tv, *tvp;
+	Pipe up, down;
+	fd_set rfd;
+	double next;
+	int m, st;
+	pid_t pid;
+
+	if (argc < 2)
+		die("usage: %s ms [command ...]\n", argv[0]);
+	delay = atoi(argv[1]) / 1E3;
+
+	if (tcgetattr(0, &orig) < 0)
+		die("tcgetattr: %s\n", strerror(errno));
+	if (ioctl(0, TIOCGWINSZ, &ws) < 0)
+		die("TIOCGWINSZ: %s\n", strerror(errno));
+	switch (pid = forkpty(&m, NULL, &orig, &ws)) {
+	case -1:
+		die("forkpty: %s\n", strerror(errno));
+	case 0:
+		argv = argc > 2 ? &argv[2] : sh;
+		execvp(argv[0], argv);
+		die("exec %s: %s\n", argv[0], strerror(errno));
+	}
+
+	/* as cfmakeraw(), which is not POSIX */
+	raw = orig;
+	raw.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL|IXON);
+	raw.c_oflag &= ~OPOST;
+	raw.c_lflag &= ~(ECHO|ECHONL|ICANON|ISIG|IEXTEN);
+	raw.c_cflag &= ~(CSIZE|PARENB);
+	raw.c_cflag |= CS8;
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(0, TCSANOW, &raw);
+	atexit(cleanup);
+	signal(SIGWINCH, sigwinch);
+
+	up = (Pipe){ .in = 0, .out = m };
+	down = (Pipe){ .in = m, .out = 1 };
+	for (;;) {
+		if (resized) {
+			resized = 0;
+			if (ioctl(0, TIOCGWINSZ, &ws) == 0)
+				ioctl(m, TIOCSWINSZ, &ws);
+		}
+
+		tvp = NULL;
+		if (up.head || down.head) {
+			next = up.head ? up.head->due : down.head->due;
+			if (up.head && down.head && down.head->due < next)
+				next = down.head->due;
+			next = MAX(next - now(), 0);
+			tv.tv_sec = next;
+			tv.tv_usec = (next - tv.tv_sec) * 1E6;
+			tvp = &tv;
+		}
+
+		FD_ZERO(&rfd);
+		FD_SET(0, &rfd);
+		FD_SET(m, &rfd);
+		if (select(m + 1, &rfd, NULL, NULL, tvp) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("select: %s\n", strerror(errno));
+		}
+		if (FD_ISSET(0, &rfd) && !pull(&up))
+			break;
+		/* the command exited, what it wrote last still goes out late */
+		if (FD_ISSET(m, &rfd) && !pull(&down)) {
+			while (down.head) {
+				next = down.head->due - now();
+				if (next > 0)
+					usleep(next * 1E6);
+				push(&down);
+			}
+			break;
+		}
+		push(&up);
+		push(&down);
+	}
+	waitpid(pid, &st, WNOHANG);
+	return 0;
+}
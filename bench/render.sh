@@ -0,0 +1,84 @@
+#!/bin/sh
+# Replays canned workloads in st under Xvfb, with a fixed geometry and font,
+# and prints the draw statistics of an st built with -DDRAWSTATS.
+#
+# usage: bench/render.sh st [workload ...]
+#
+# Workloads are startup, truecolor, ls, vim, btop and images; the last three
+# are skipped when vim, btop or the images in $BENCHIMAGES are not there.
+# startup only draws a prompt, to time the start up to it.
+
+# full-screen truecolor repaints, as from vim with termguicolors
+if [ "$1" = --truecolor ]; then
+	awk -v cols="$2" -v rows="$3" 'BEGIN {
+		printf "\033[?1049h"
+		for (f = 0; f < 200; f++) {
+			printf "\033[H"
+			for (y = 0; y < rows; y++) {
+				for (x = 0; x < cols; x++)
+					printf "\033[38;2;%d;%d;%dm%c",
+					       (x * 8 + f) % 256, (y * 5) % 256,
+					       (f * 3) % 256, 33 + (x + y + f) % 94
+				printf "\033[0m"
+				if (y < rows - 1)
+					printf "\r\n"
+			}
+		}
+		printf "\033[?1049l"
+	}'
+	exit
+fi
+
+st="${1:?usage: $0 st [workload ...]}"
+shift
+[ $# -gt 0 ] || set -- startup truecolor ls vim btop images
+
+display="${BENCHDISPLAY:-:99}"
+geometry="${BENCHGEOMETRY:-160x50}"
+font="${BENCHFONT:-monospace:pixelsize=14:antialias=true:autohint=false}"
+bench="$(cd "$(dirname "$0")" && pwd)"
+
+command -v Xvfb >/dev/null || { echo "$0: Xvfb not found" >&2; exit 1; }
+Xvfb "$display" -screen 0 1920x1080x24 -nolisten tcp >/dev/null 2>&1 &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null' EXIT INT TERM
+i=0
+while [ ! -e "/tmp/.X11-unix/X${display#:}" ]; do
+	i=$((i + 1))
+	[ $i -le 50 ] || { echo "$0: Xvfb did not start" >&2; exit 1; }
+	sleep 0.1
+done
+
+workload() {
+	case "$1" in
+	startup)
+		echo "printf '\$ '" ;;
+	truecolor)
+		echo "$bench/render.sh --truecolor ${geometry%x*} ${geometry#*x}" ;;
+	ls)
+		echo "ls -lR --color=always /usr/share | head -n 100000" ;;
+	vim)
+		command -v vim >/dev/null || return 1
+		echo "vim -u NONE -N -c 'set termguicolors | syntax on' -c" \
+		     "'for i in range(300) | exe \"normal! \\<C-d>\" | redraw |" \
+		     "endfor | qa!' $bench/../st.c" ;;
+	btop)
+		command -v btop >/dev/null || return 1
+		echo "timeout 10 btop" ;;
+	images)
+		[ -n "$BENCHIMAGES" ] || return 1
+		echo "for f in $BENCHIMAGES/*; do" \
+		     "sh $bench/../icat-mini.sh -c 40 -r 20 \"\$f\"; done" ;;
+	*)
+		return 1 ;;
+	esac
+}
+
+printf '%-10s %s\n' workload statistics
+for w in "$@"; do
+	cmd="$(workload "$w")" || { printf '%-10s skipped\n' "$w"; continue; }
+	stats="$(DISPLAY="$display" "$st" -g "$geometry" -f "$font" \
+		-e sh -c "$cmd; kill -TERM \$PPID; exec sleep 60" 2>&1 |
+		grep '^frames')"
+	printf '%-10s %s\n' "$w" "${stats:-failed}"
+done
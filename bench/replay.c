@@ -0,0 +1,478 @@
+/* See LICENSE for license details. */
+/*
+ * Replays byte streams through the terminal core without X, timing the
+ * parser and checking that feeding a stream at once gives the same grid as
+ * feeding it one byte at a time, the reference path that any fast path in
+ * twrite() must agree with. Streams are the files given, or random ones.
+ *
+ * usage: bench/replay [-d | -t] [-c cols] [-r rows] [-n streams] [-s seed]
+ *                     [file ...]
+ *
+ * -d prints the grid of each file instead, to be kept as a golden screen.
+ * -t checks that each file name.in, fed at once and one byte at a time, gives
+ * the golden screen name.screen, and exits with 1 if one does not. The
+ * streams in bench/golden are 80x24 sessions recorded with script(1), and
+ * their screens were made with -d; make check runs them. -t also checks that
+ * leaving the alternate screen puts the primary one back without redrawing,
+ * and that the guesses of the local echo stay out of the grid and are not
+ * shown at a password prompt.
+ */
+#include "../st.c"
+
+#include <time.h>
+
+#include "../arg.h"
+
+#define STREAMLEN	(1 << 20)
+
+typedef struct {
+	Rune r[CLUSTER_MAX];
+	ushort mode;
+	uint32_t fg, bg, decor;
+} Cell;
+
+typedef struct {
+	Cell *cells;
+	int nlines;
+	int cx, cy, mode;
+} Grid;
+
+static double now(void);
+static char *randstream(size_t *);
+static void feed(const char *, size_t, size_t);
+static void snapshot(Grid *);
+static int compare(const Grid *, const Grid *);
+static void dumpgrid(FILE *);
+static char *readfile(const char *, size_t *);
+static int checkgolden(const char *);
+static int checkprimary(void);
+static void output(const char *);
+static int checkpredict(void);
+
+/* config.h globals */
+char *utmp = NULL;
+char *scroll = NULL;
+char *stty_args = "";
+char *vtiden = "\033[?62c";
+wchar_t *worddelimiters = L" ";
+int allowaltscreen = 1;
+int allowwindowops = 0;
+int scrollpin = 1;
+unsigned int predicttimeout = 0;
+char *termname = "st-256color";
+unsigned int tabspaces = 8;
+unsigned int defaultfg = 258;
+unsigned int defaultbg = 259;
+unsigned int defaultcs = 256;
+const int boxdraw = 0, boxdraw_bold = 0, boxdraw_braille = 0;
+int exportattrs = 1;
+MouseKey mkeys[] = { { 0 } };
+GraphicsCommandResult graphics_command_result;
+
+char *argv0;
+static int cols = 80, rows = 24;
+
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+/* text, wide and combining runes, controls, escapes and placeholders */
+char *
+randstream(size_t *len)
+{
+	static const char *seqs[] = {
+		"\r\n", "\n", "\r", "\t", "\b", "\033[H", "\033[2J", "\033[K",
+		"\033[1;31m", "\033[0m", "\033[4m", "\033[38;2;1;2;3m",
+		"\033[48;5;200m", "\033[7m", "\033[5;10r", "\033[r", "\033[3L",
+		"\033[2M", "\033[4@", "\033[3P", "\033[2S", "\033[2T", "\033M",
+		"\033[?1049h", "\033[?1049l", "\033[?7l", "\033[?7h", "\033[10G",
+		"\033[5;5H", "\033[4h", "\033[4l", "\033]2;title\007", "\033(0",
+		"\033(B", "\033[6n", "\033[2X",
+		"\033[?69h", "\033[?69l", "\033[10;50s", "\033[s", "\033[?6h",
+		"\033[?6l",
+		"\xe4\xb8\xad", "\xf0\x9f\x98\x80", "e\xcc\x81", "\xcc\x88",
+		"\xe2\x80\x8d", "\xf4\x8e\xbb\xae\xcc\x85",
+	};
+	char *s = xmalloc(STREAMLEN + 16), *p = s;
+	const char *q;
+
+	while (p < s + STREAMLEN) {
+		if (rand() % 4) {
+			*p++ = ' ' + rand() % 95;
+		} else {
+			for (q = seqs[rand() % LEN(seqs)]; *q; )
+				*p++ = *q++;
+		}
+	}
+	*len = p - s;
+	return s;
+}
+
+/* Feeds s in chunks of at most step bytes, keeping split UTF-8 like ttyread */
+void
+feed(const char *s, size_t len, size_t step)
+{
+	char buf[BUFSIZ];
+	size_t n, left = 0;
+	int written;
+
+	tnew(cols, rows);
+	while (len > 0) {
+		n = MIN(MIN(step, len), sizeof(buf) - left);
+		memcpy(buf + left, s, n);
+		s += n;
+		len -= n;
+		left += n;
+		written = twrite(buf, left, 0);
+		left -= written;
+		memmove(buf, buf + written, left);
+	}
+}
+
+void
+snapshot(Grid *g)
+{
+	LineBuffer *lb;
+	const Rune *cluster;
+	Cell *c;
+	Line line;
+	int i, s, x, len;
+
+	g->cells = xmalloc((HISTSIZE + rows) * cols * sizeof(Cell));
+	g->nlines = 0;
+	for (s = 0; s < 2; s++) {
+		lb = &term.screen[s];
+		for (i = term.row - lb->size; i < term.row; i++) {
+			line = lb->buffer[(lb->cur + i + lb->size) % lb->size];
+			if (!line)
+				continue;
+			c = &g->cells[g->nlines++ * cols];
+			memset(c, 0, cols * sizeof(Cell));
+			for (x = 0; x < cols; x++, c++) {
+				c->mode = line[x].mode;
+				c->fg = line[x].fg;
+				c->bg = line[x].bg;
+				c->decor = line[x].decor;
+				if (line[x].mode & ATTR_COMBINING) {
+					cluster = tgetcluster(&line[x], &len);
+					memcpy(c->r, cluster, len * sizeof(Rune));
+				} else {
+					c->r[0] = line[x].u;
+				}
+			}
+		}
+	}
+	g->cx = term.c.x;
+	g->cy = term.c.y;
+	g->mode = term.mode;
+}
+
+/* returns 0 when the grids are the same, after reporting the first change */
+int
+compare(const Grid *a, const Grid *b)
+{
+	int i;
+
+	if (a->cx != b->cx || a->cy != b->cy || a->mode != b->mode) {
+		printf("cursor %d,%d mode %x != cursor %d,%d mode %x\n",
+		       a->cx, a->cy, a->mode, b->cx, b->cy, b->mode);
+		return 1;
+	}
+	if (a->nlines != b->nlines) {
+		printf("%d lines != %d lines\n", a->nlines, b->nlines);
+		return 1;
+	}
+	for (i = 0; i < a->nlines * cols; i++) {
+		if (memcmp(&a->cells[i], &b->cells[i], sizeof(Cell))) {
+			printf("line %d col %d: U+%04X mode %x != U+%04X mode %x\n",
+			       i / cols, i % cols, a->cells[i].r[0],
+			       a->cells[i].mode, b->cells[i].r[0],
+			       b->cells[i].mode);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* the text of each row, then its wide, dummy, cluster and image cells */
+void
+dumpgrid(FILE *f)
+{
+	const Rune *cluster;
+	char buf[UTF_SIZ];
+	Line line;
+	int x, y, i, len;
+
+	for (y = 0; y < term.row; y++) {
+		line = TLINE(y);
+		for (x = 0; x < term.col; x++) {
+			if (line[x].mode & ATTR_WDUMMY)
+				continue;
+			if (!(line[x].mode & ATTR_COMBINING)) {
+				fwrite(buf, 1, utf8encode(line[x].u, buf), f);
+				continue;
+			}
+			cluster = tgetcluster(&line[x], &len);
+			for (i = 0; i < len; i++)
+				fwrite(buf, 1, utf8encode(cluster[i], buf), f);
+		}
+		fputc('|', f);
+		for (x = 0; x < term.col; x++) {
+			fputc((line[x].mode & ATTR_IMAGE) ? 'i' :
+			      (line[x].mode & ATTR_COMBINING) ? 'c' :
+			      (line[x].mode & ATTR_WDUMMY) ? 'd' :
+			      (line[x].mode & ATTR_WIDE) ? 'w' : '.', f);
+		}
+		fputs((line[term.col - 1].mode & ATTR_WRAP) ? "+\n" : "\n", f);
+	}
+	fprintf(f, "cursor %d,%d\n", term.c.x, term.c.y);
+}
+
+char *
+readfile(const char *name, size_t *len)
+{
+	FILE *f;
+	char *s = NULL;
+	size_t cap = 0, n;
+
+	if (!(f = fopen(name, "r")))
+		die("%s: %s\n", name, strerror(errno));
+	*len = 0;
+	do {
+		if (*len == cap)
+			s = xrealloc(s, cap += STREAMLEN);
+		n = fread(s + *len, 1, cap - *len, f);
+		*len += n;
+	} while (n > 0);
+	fclose(f);
+	return s;
+}
+
+/* returns 0 when name.in gives name.screen, after reporting the first change */
+int
+checkgolden(const char *name)
+{
+	char *in, *want, *got, path[PATH_MAX];
+	size_t inlen, wantlen, gotlen, i, line;
+	FILE *f;
+	int step, differ = 0;
+
+	if (snprintf(path, sizeof(path), "%.*s.screen",
+	             (int)(strlen(name) - strlen(".in")), name) >= sizeof(path))
+		die("%s: name too long\n", name);
+	in = readfile(name, &inlen);
+	want = readfile(path, &wantlen);
+	for (step = 0; step < 2 && !differ; step++) {
+		feed(in, inlen, step ? 1 : inlen);
+		if (!(f = tmpfile()))
+			die("tmpfile: %s\n", strerror(errno));
+		dumpgrid(f);
+		gotlen = ftell(f);
+		rewind(f);
+		got = xmalloc(gotlen + 1);
+		if (fread(got, 1, gotlen, f) != gotlen)
+			die("tmpfile: short read\n");
+		fclose(f);
+
+		for (i = 0, line = 1; i < gotlen && i < wantlen &&
+		     got[i] == want[i]; i++)
+			line += got[i] == '\n';
+		if (gotlen != wantlen || i < gotlen) {
+			printf("%-32.32s differs from %s on line %zu, fed %s\n",
+			       name, path, line, step ? "bytewise" : "at once");
+			differ = 1;
+		}
+		free(got);
+	}
+	if (!differ)
+		printf("%-32.32s ok\n", name);
+	free(want);
+	free(in);
+	return differ;
+}
+
+/* returns 0 when only the cursor row is dirty after an alternate screen */
+int
+checkprimary(void)
+{
+	static const char before[] = "primary\r\n$ ";
+	static const char alt[] = "\033[?1049h\033[2Jalternate\r\n\033[?1049l";
+	int y, ndirty = 0;
+
+	tnew(cols, rows);
+	twrite(before, sizeof(before) - 1, 0);
+	/* as drawn */
+	memset(term.dirty, 0, term.row * sizeof(*term.dirty));
+	term.ocx = term.c.x;
+	term.ocy = term.c.y;
+	twrite(alt, sizeof(alt) - 1, 0);
+	for (y = 0; y < term.row; y++)
+		ndirty += term.dirty[y];
+	if (ndirty != 1 || !term.dirty[term.c.y] || TLINE(0)[0].u != 'p') {
+		printf("%-32s %d rows dirty\n", "primary screen", ndirty);
+		return 1;
+	}
+	printf("%-32s ok\n", "primary screen");
+	return 0;
+}
+
+/* output of the shell, as ttyread() handles it */
+void
+output(const char *s)
+{
+	tpredictdirty();
+	twrite(s, strlen(s), 0);
+	tpredictsettle();
+}
+
+/* returns 0 when typing shows guesses only while the shell echoes them */
+int
+checkpredict(void)
+{
+	const char *err = NULL;
+	int y;
+
+	predicttimeout = 1000;
+	tnew(cols, rows);
+	output("$ ");
+	ttywrite("s", 1, 1);
+	if (tpredictrow() >= 0)
+		err = "shown before any echo";
+	output("s");
+	ttywrite("u", 1, 1);
+	y = term.c.y;
+	if (!err && tpredictrow() != y)
+		err = "not shown after an echo";
+	if (!err && (TLINE(y)[3].u != ' ' ||
+	    tpredictover(TLINE(y), y)[3].u != 'u'))
+		err = "not kept out of the grid";
+	output("u");
+	ttywrite("\r", 1, 1);
+	if (!err && tpredictrow() >= 0)
+		err = "shown after a control key";
+	output("\r\n[sudo] password: ");
+	ttywrite("hun", 3, 1);
+	if (!err && tpredictrow() >= 0)
+		err = "shown at a password prompt";
+	predicttimeout = 0;
+	if (err) {
+		printf("%-32s %s\n", "predictive echo", err);
+		return 1;
+	}
+	printf("%-32s ok\n", "predictive echo");
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	Grid ref, fast;
+	char *s;
+	size_t len;
+	double t0, tref, tfast;
+	int i, dump = 0, golden = 0, nstreams = 4, seed = 1, differ = 0;
+
+	ARGBEGIN {
+	case 'c':
+		cols = atoi(EARGF(die("-c needs a width\n")));
+		break;
+	case 'd':
+		dump = 1;
+		break;
+	case 'n':
+		nstreams = atoi(EARGF(die("-n needs a count\n")));
+		break;
+	case 'r':
+		rows = atoi(EARGF(die("-r needs a height\n")));
+		break;
+	case 's':
+		seed = atoi(EARGF(die("-s needs a seed\n")));
+		break;
+	case 't':
+		golden = 1;
+		break;
+	default:
+		die("usage: %s [-d | -t] [-c cols] [-r rows] [-n streams]"
+		    " [-s seed] [file ...]\n", argv0);
+	} ARGEND;
+
+	/* answers to queries are written to the tty */
+	if ((cmdfd = open("/dev/null", O_RDWR)) < 0)
+		die("/dev/null: %s\n", strerror(errno));
+	srand(seed);
+	if (argc > 0)
+		nstreams = argc;
+
+	if (golden) {
+		for (i = 0; i < argc; i++)
+			differ |= checkgolden(argv[i]);
+		differ |= checkprimary();
+		differ |= checkpredict();
+		return differ;
+	}
+	if (!dump) {
+		printf("%-24s %10s %14s %14s %6s\n", "stream", "bytes",
+		       "bytewise MB/s", "at once MB/s", "same");
+	}
+	for (i = 0; i < nstreams; i++) {
+		s = argc > 0 ? readfile(argv[i], &len) : randstream(&len);
+		if (dump) {
+			feed(s, len, len);
+			dumpgrid(stdout);
+			free(s);
+			continue;
+		}
+
+		t0 = now();
+		feed(s, len, 1);
+		tref = now() - t0;
+		snapshot(&ref);
+
+		t0 = now();
+		feed(s, len, len);
+		tfast = now() - t0;
+		snapshot(&fast);
+
+		printf("%-24.24s %10zu %14.1f %14.1f %6s\n",
+		       argc > 0 ? argv[i] : "random", len, len / tref / 1E6,
+		       len / tfast / 1E6, compare(&ref, &fast) ? "no" : "yes");
+		differ |= compare(&ref, &fast);
+		free(ref.cells);
+		free(fast.cells);
+		free(s);
+	}
+
+	return differ;
+}
+
+/* The window and the images are not there */
+void xbell(void) {}
+void xclipcopy(void) {}
+void xdrawcursor(int x, int y, Glyph g, int ox, int oy, Glyph og) {}
+void xdrawline(Line line, int x1, int y1, int x2) {}
+void xflushlines(void) {}
+void xfinishdraw(void) {}
+void xloadcols(void) {}
+int xsetcolorname(int x, const char *name) { return 1; }
+int xgetcolor(int x, unsigned char *r, unsigned char *g, unsigned char *b) { return 1; }
+void xseticontitle(char *p) {}
+void xsettitle(char *p) {}
+int xsetcursor(int cursor) { return 0; }
+void xsetmode(int set, unsigned int flags) {}
+void xscrollview(int n) {}
+int xsaveprimary(void) { return 1; }
+int xrestoreprimary(void) { return 1; }
+void xsetpointermotion(int set) {}
+void xsetsel(char *str) { free(str); }
+int xstartdraw(void) { return 0; }
+void xximspot(int x, int y) {}
+void xstartimagedraw(int *dirty, int rows) {}
+void xfinishimagedraw() {}
+int gr_parse_command(char *buf, size_t len) { return 0; }
+int isboxdraw(Rune u) { return 0; }
+ushort boxdrawindex(const Glyph *g) { return 0; }
@@ -0,0 +1,107 @@
+/* See LICENSE for license details. */
+/*
+ * Compares the per-rune cost of runewidth() (the generated tables in
+ * unicode.c) with libc's wcwidth() and counts the runes where they differ.
+ */
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <wchar.h>
+
+#include "../st.h"
+
+#define ITERATIONS 200
+
+typedef struct {
+	const char *name;
+	Rune first, last;
+} Range;
+
+static const Range ranges[] = {
+	{ "latin/cyrillic", 0x00A0, 0x04FF },
+	{ "combining",      0x0300, 0x036F },
+	{ "cjk",            0x4E00, 0x9FFF },
+	{ "hangul",         0xAC00, 0xD7A3 },
+	{ "emoji",          0x1F300, 0x1FAFF },
+	{ "bmp",            0x00A0, 0xFFFF },
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1E9 + ts.tv_nsec;
+}
+
+int
+main(void)
+{
+	const Range *r;
+	Rune *runes, u;
+	size_t n, i, it, diff;
+	double t0, twc, ttab;
+	volatile int sink = 0;
+	int w;
+
+	if (!setlocale(LC_CTYPE, "") || MB_CUR_MAX == 1)
+		setlocale(LC_CTYPE, "C.UTF-8");
+
+	printf("%-16s %8s %12s %12s %8s\n",
+	       "range", "runes", "wcwidth ns", "table ns", "differ");
+	for (r = ranges; r < ranges + LEN(ranges); r++) {
+		n = r->last - r->first + 1;
+		runes = xmalloc(n * sizeof(*runes));
+		/* shuffle to defeat the branch predictor and prefetcher */
+		for (i = 0; i < n; i++)
+			runes[i] = r->first + i;
+		for (i = n - 1; i > 0; i--) {
+			size_t j = rand() % (i + 1);
+			u = runes[i], runes[i] = runes[j], runes[j] = u;
+		}
+
+		t0 = now();
+		for (it = 0; it < ITERATIONS; it++)
+			for (i = 0; i < n; i++)
+				sink += wcwidth(runes[i]);
+		twc = (now() - t0) / (ITERATIONS * n);
+
+		t0 = now();
+		for (it = 0; it < ITERATIONS; it++)
+			for (i = 0; i < n; i++)
+				sink += runewidth(runes[i]);
+		ttab = (now() - t0) / (ITERATIONS * n);
+
+		for (diff = i = 0; i < n; i++) {
+			/* st treats wcwidth() == -1 as a single cell */
+			if ((w = wcwidth(runes[i])) == -1)
+				w = 1;
+			diff += w != runewidth(runes[i]);
+		}
+
+		printf("%-16s %8zu %12.2f %12.2f %8zu\n",
+		       r->name, n, twc, ttab, diff);
+		free(runes);
+	}
+
+	return sink == 42;
+}
+
+void
+die(const char *errstr, ...)
+{
+	fputs(errstr, stderr);
+	exit(1);
+}
+
+void *
+xmalloc(size_t len)
+{
+	void *p;
+
+	if (!(p = malloc(len)))
+		die("malloc failed\n");
+	return p;
+}
@@ -12,7 +12,6 @@
 
 static Display *xdpy;
 static Colormap xcmap;
-static XftDraw *xd;
 static Visual *xvis;
 
 static void drawbox(int, int, int, int, XftColor *, XftColor *, ushort);
@@ -21,9 +20,9 @@ static void drawboxlines(int, int, int, int, XftColor *, ushort);
 /* public API */
 
 void
-boxdraw_xinit(Display *dpy, Colormap cmap, XftDraw *draw, Visual *vis)
+boxdraw_xinit(Display *dpy, Colormap cmap, Visual *vis)
 {
-	xdpy = dpy; xcmap = cmap; xd = draw, xvis = vis;
+	xdpy = dpy; xcmap = cmap; xvis = vis;
 }
 
 int
@@ -66,32 +65,32 @@ drawbox(int x, int y, int w, int h, XftColor *fg, XftColor *bg, ushort bd)
 	} else if (cat == BBD) {
 		/* lower (8-X)/8 block */
 		int d = DIV((uint8_t)bd * h, 8);
-		XftDrawRect(xd, fg, x, y + d, w, h - d);
+		xdrawrect(fg, x, y + d, w, h - d);
 
 	} else if (cat == BBU) {
 		/* upper X/8 block */
-		XftDrawRect(xd, fg, x, y, w, DIV((uint8_t)bd * h, 8));
+		xdrawrect(fg, x, y, w, DIV((uint8_t)bd * h, 8));
 
 	} else if (cat == BBL) {
 		/* left X/8 block */
-		XftDrawRect(xd, fg, x, y, DIV((uint8_t)bd * w, 8), h);
+		xdrawrect(fg, x, y, DIV((uint8_t)bd * w, 8), h);
 
 	} else if (cat == BBR) {
 		/* right (8-X)/8 block */
 		int d = DIV((uint8_t)bd * w, 8);
-		XftDrawRect(xd, fg, x + d, y, w - d, h);
+		xdrawrect(fg, x + d, y, w - d, h);
 
 	} else if (cat == BBQ) {
 		/* Quadrants */
 		int w2 = DIV(w, 2), h2 = DIV(h, 2);
 		if (bd & TL)
-			XftDrawRect(xd, fg, x, y, w2, h2);
+			xdrawrect(fg, x, y, w2, h2);
 		if (bd & TR)
-			XftDrawRect(xd, fg, x + w2, y, w - w2, h2);
+			xdrawrect(fg, x + w2, y, w - w2, h2);
 		if (bd & BL)
-			XftDrawRect(xd, fg, x, y + h2, w2, h - h2);
+			xdrawrect(fg, x, y + h2, w2, h - h2);
 		if (bd & BR)
-			XftDrawRect(xd, fg, x + w2, y + h2, w - w2, h - h2);
+			xdrawrect(fg, x + w2, y + h2, w - w2, h - h2);
 
 	} else if (bd & BBS) {
 		/* Shades - data is 1/2/3 for 25%/50%/75% alpha, respectively */
@@ -104,7 +103,7 @@ drawbox(int x, int y, int w, int h, XftColor *fg, XftColor *bg, ushort bd)
 		xrc.blue = DIV(fg->color.blue * d + bg->color.blue * (4 - d), 4);
 
 		XftColorAllocValue(xdpy, xvis, xcmap, &xrc, &xfc);
-		XftDrawRect(xd, &xfc, x, y, w, h);
+		xdrawrect(&xfc, x, y, w, h);
 		XftColorFree(xdpy, xvis, xcmap, &xfc);
 
 	} else if (cat == BRL) {
@@ -112,14 +111,14 @@ drawbox(int x, int y, int w, int h, XftColor *fg, XftColor *bg, ushort bd)
 		int w1 = DIV(w, 2);
 		int h1 = DIV(h, 4), h2 = DIV(h, 2), h3 = DIV(3 * h, 4);
 
-		if (bd & 1)   XftDrawRect(xd, fg, x, y, w1, h1);
-		if (bd & 2)   XftDrawRect(xd, fg, x, y + h1, w1, h2 - h1);
-		if (bd & 4)   XftDrawRect(xd, fg, x, y + h2, w1, h3 - h2);
-		if (bd & 8)   XftDrawRect(xd, fg, x + w1, y, w - w1, h1);
-		if (bd & 16)  XftDrawRect(xd, fg, x + w1, y + h1, w - w1, h2 - h1);
-		if (bd & 32)  XftDrawRect(xd, fg, x + w1, y + h2, w - w1, h3 - h2);
-		if (bd & 64)  XftDrawRect(xd, fg, x, y + h3, w1, h - h3);
-		if (bd & 128) XftDrawRect(xd, fg, x + w1, y + h3, w - w1, h - h3);
+		if (bd & 1)   xdrawrect(fg, x, y, w1, h1);
+		if (bd & 2)   xdrawrect(fg, x, y + h1, w1, h2 - h1);
+		if (bd & 4)   xdrawrect(fg, x, y + h2, w1, h3 - h2);
+		if (bd & 8)   xdrawrect(fg, x + w1, y, w - w1, h1);
+		if (bd & 16)  xdrawrect(fg, x + w1, y + h1, w - w1, h2 - h1);
+		if (bd & 32)  xdrawrect(fg, x + w1, y + h2, w - w1, h3 - h2);
+		if (bd & 64)  xdrawrect(fg, x, y + h3, w1, h - h3);
+		if (bd & 128) xdrawrect(fg, x + w1, y + h3, w - w1, h - h3);
 
 	}
 }
@@ -151,13 +150,13 @@ drawboxlines(int x, int y, int w, int h, XftColor *fg, ushort bd)
 		int d = arc || (multi_double && !multi_light) ? -s : 0;
 
 		if (bd & LL)
-			XftDrawRect(xd, fg, x, y + h2, w2 + s + d, s);
+			xdrawrect(fg, x, y + h2, w2 + s + d, s);
 		if (bd & LU)
-			XftDrawRect(xd, fg, x + w2, y, s, h2 + s + d);
+			xdrawrect(fg, x + w2, y, s, h2 + s + d);
 		if (bd & LR)
-			XftDrawRect(xd, fg, x + w2 - d, y + h2, w - w2 + d, s);
+			xdrawrect(fg, x + w2 - d, y + h2, w - w2 + d, s);
 		if (bd & LD)
-			XftDrawRect(xd, fg, x + w2, y + h2 - d, s, h - h2 + d);
+			xdrawrect(fg, x + w2, y + h2 - d, s, h - h2 + d);
 	}
 
 	/* double lines - also align with light to form heavy when combined */
@@ -172,23 +171,23 @@ drawboxlines(int x, int y, int w, int h, XftColor *fg, ushort bd)
 		int dl = bd & DL, du = bd & DU, dr = bd & DR, dd = bd & DD;
 		if (dl) {
 			int p = dd ? -s : 0, n = du ? -s : dd ? s : 0;
-			XftDrawRect(xd, fg, x, y + h2 + s, w2 + s + p, s);
-			XftDrawRect(xd, fg, x, y + h2 - s, w2 + s + n, s);
+			xdrawrect(fg, x, y + h2 + s, w2 + s + p, s);
+			xdrawrect(fg, x, y + h2 - s, w2 + s + n, s);
 		}
 		if (du) {
 			int p = dl ? -s : 0, n = dr ? -s : dl ? s : 0;
-			XftDrawRect(xd, fg, x + w2 - s, y, s, h2 + s + p);
-			XftDrawRect(xd, fg, x + w2 + s, y, s, h2 + s + n);
+			xdrawrect(fg, x + w2 - s, y, s, h2 + s + p);
+			xdrawrect(fg, x + w2 + s, y, s, h2 + s + n);
 		}
 		if (dr) {
 			int p = du ? -s : 0, n = dd ? -s : du ? s : 0;
-			XftDrawRect(xd, fg, x + w2 - p, y + h2 - s, w - w2 + p, s);
-			XftDrawRect(xd, fg, x + w2 - n, y + h2 + s, w - w2 + n, s);
+			xdrawrect(fg, x + w2 - p, y + h2 - s, w - w2 + p, s);
+			xdrawrect(fg, x + w2 - n, y + h2 + s, w - w2 + n, s);
 		}
 		if (dd) {
 			int p = dr ? -s : 0, n = dl ? -s : dr ? s : 0;
-			XftDrawRect(xd, fg, x + w2 + s, y + h2 - p, s, h - h2 + p);
-			XftDrawRect(xd, fg, x + w2 - s, y + h2 - n, s, h - h2 + n);
+			xdrawrect(fg, x + w2 + s, y + h2 - p, s, h - h2 + p);
+			xdrawrect(fg, x + w2 - s, y + h2 - n, s, h - h2 + n);
 		}
 	}
 }
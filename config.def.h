@@ -7,7 +7,22 @@
  * default: static char *font = "Liberation Mono:pixelsize=12:antialias=true:autohint=true";
  */
 static char *font = "Cousine Nerd Font:style=regular:antialias=true:pixelsize=12";
+/*
+ * renderer: "xft" draws each run of cells with Xft, "xrender" batches the
+ * fills and glyphs of a whole line into a few requests, "soft" rasterizes
+ * the cells in st and sends the changed pixels. The last two need fewer
+ * requests, which matters on remote displays.
+ */
+static char *render = "xft";
 static int borderpx = 2;
+/* number of other font sizes kept loaded, so that zooming back is instant */
+static unsigned int fontcachesize = 4;
+
+/*
+ * seconds of inactivity after which the memory left over by bursts of output
+ * is released, 0 to only do it on SIGUSR2
+ */
+static unsigned int compacttimeout = 60;
 
 /* How to align the content in the window when the size of the terminal
  * doesn't perfectly match the size of the window. The values are percentages.
@@ -30,6 +45,9 @@ char *utmp = NULL;
 char *scroll = NULL;
 char *stty_args = "stty raw pass8 nl -echo -iexten -cstopb 38400";
 
+/* exporthistory: keep the colors and attributes as SGR sequences */
+int exportattrs = 1;
+
 /* identification sequence returned in DA and DECID */
 /* By default, use the same one as kitty. */
 char *vtiden = "\033[?62c";
@@ -52,6 +70,16 @@ static unsigned int tripleclicktimeout = 600;
 /* alt screens */
 int allowaltscreen = 1;
 
+/* keep the view scrolled back on the same lines while output arrives */
+int scrollpin = 1;
+
+/*
+ * predictive local echo, for slow links: typed text is drawn underlined
+ * before the shell echoes it. A guess not echoed within predicttimeout ms is
+ * taken back, 0 disables it. bench/lag makes a slow link to try it on.
+ */
+unsigned int predicttimeout = 0;
+
 /* allow certain non-interactive (insecure) window operations such as:
    setting the clipboard text */
 int allowwindowops = 0;
@@ -227,6 +255,11 @@ static uint forcemousemod = ShiftMask;
  */
 
 const unsigned mousescrollspeed = 12;
+/*
+ * duration in ms of the pixel smooth scrolling through the history, e.g. for
+ * touchpads; 0 to jump at once
+ */
+static unsigned int scrollduration = 0;
 
 /*
  * Internal mouse shortcuts.
@@ -248,6 +281,7 @@ static Shortcut shortcuts[] = {
 	{ XK_ANY_MOD,           XK_Break,       sendbreak,      {.i =  0} },
 	{ ControlMask,          XK_Print,       toggleprinter,  {.i =  0} },
 	{ ShiftMask,            XK_Print,       printscreen,    {.i =  0} },
+	{ TERMMOD,              XK_S,           exporthistory,  {.v = "|cat > \"$HOME/st-history-$(date +%Y%m%d-%H%M%S)\""} },
 	{ XK_ANY_MOD,           XK_Print,       printsel,       {.i =  0} },
 	{ TERMMOD,              XK_plus,        zoom,           {.f = +2} },
 	{ TERMMOD,              XK_underscore,  zoom,           {.f = -2} },
@@ -263,6 +297,9 @@ static Shortcut shortcuts[] = {
 	{ TERMMOD,              XK_Num_Lock,    numlock,        {.i =  0} },
 	{ ShiftMask,            XK_Page_Up,     kscrollup,      {.i = -1} },
 	{ ShiftMask,            XK_Page_Down,   kscrolldown,    {.i = -1} },
+	{ TERMMOD,              XK_Z,           kscrolltoprompt, {.i = -1} },
+	{ TERMMOD,              XK_X,           kscrolltoprompt, {.i = +1} },
+	{ TERMMOD,              XK_G,           selectoutput,   {.i =  0} },
 	{ TERMMOD,              XK_F1,          togglegrdebug,  {.i =  0} },
 	{ TERMMOD,              XK_F6,          dumpgrstate,    {.i =  0} },
 	{ TERMMOD,              XK_F7,          unloadimages,   {.i =  0} },
@@ -28,16 +28,22 @@ X11LIB = /usr/X11R6/lib
 
 PKG_CONFIG = pkg-config
 
+# HarfBuzz text shaping, for ligatures; uncomment to enable
+#HBSRC = hb.c
+#HBINC = -DHARFBUZZ `$(PKG_CONFIG) --cflags harfbuzz`
+#HBLIB = `$(PKG_CONFIG) --libs harfbuzz`
+
 # includes and libs
 INCS = -I$(X11INC) \
        `$(PKG_CONFIG) --cflags imlib2` \
        `$(PKG_CONFIG) --cflags fontconfig` \
-       `$(PKG_CONFIG) --cflags freetype2`
-LIBS = -L$(X11LIB) -lm -lrt -lX11 -lutil -lXft -lXrender \
-       `$(PKG_CONFIG) --libs imlib2` \
-       `$(PKG_CONFIG) --libs zlib` \
+       `$(PKG_CONFIG) --cflags freetype2` \
+       $(HBINC)
+# Imlib2 and zlib are opened with dlopen on the first image
+LIBS = -L$(X11LIB) -lm -lrt -lX11 -lutil -lXft -lXrender -lXext -ldl \
        `$(PKG_CONFIG) --libs fontconfig` \
-       `$(PKG_CONFIG) --libs freetype2`
+       `$(PKG_CONFIG) --libs freetype2` \
+       $(HBLIB)
 
 # flags
 STCPPFLAGS = -DVERSION=\"$(VERSION)\" -D_XOPEN_SOURCE=600
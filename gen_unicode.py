@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# Generates unicode.c: two-level lookup tables holding the display width, the
+# canonical combining class and the image placeholder diacritic number of
+# every code point. The Unicode data comes from the unicodedata module of the
+# Python interpreter running this script, the diacritics from
+# rowcolumn-diacritics.txt.
+#
+# usage: ./gen_unicode.py [rowcolumn-diacritics.txt] > unicode.c
+
+import sys
+import unicodedata
+
+MAXRUNE = 0x110000
+
+# Prepended concatenation marks are format characters that are displayed
+PREPENDED = set(range(0x600, 0x606)) | {0x6DD, 0x70F, 0x890, 0x891, 0x8E2,
+                                        0x110BD, 0x110CD}
+
+
+def width(cp):
+    """Column width, following what glibc's wcwidth() does for UTF-8
+    locales, except that unassigned and control code points get 1."""
+    ch = chr(cp)
+    cat = unicodedata.category(ch)
+    if cat == "Cn":
+        return 1
+    if cat in ("Mn", "Me") or \
+       (cat == "Cf" and cp != 0xAD and cp not in PREPENDED):
+        return 0
+    if 0x1160 <= cp <= 0x11FF:  # Hangul medial vowels and final consonants
+        return 0
+    if unicodedata.east_asian_width(ch) in ("W", "F"):
+        return 2
+    return 1
+
+
+def readdiacritics(path):
+    nums = {}
+    with open(path) as f:
+        for line in f:
+            line = line.split("#", 1)[0].strip()
+            if line:
+                nums[int(line, 16)] = len(nums) + 1
+    return nums
+
+
+def splittables(props, shift):
+    """Splits the per-rune record indices into blocks of 1 << shift runes,
+    deduplicating identical blocks."""
+    size = 1 << shift
+    blocks, stage1, stage2 = {}, [], []
+    for i in range(0, MAXRUNE, size):
+        block = tuple(props[i:i + size])
+        if block not in blocks:
+            blocks[block] = len(blocks)
+            stage2.extend(block)
+        stage1.append(blocks[block])
+    return stage1, stage2
+
+
+def ctype(values):
+    return "uint8_t" if max(values) < 256 else "uint16_t"
+
+
+def tablebytes(stage1, stage2):
+    return sum(len(t) * (1 if ctype(t) == "uint8_t" else 2)
+               for t in (stage1, stage2))
+
+
+def emit(name, type, values, perline=16):
+    print("static const %s %s[] = {" % (type, name))
+    for i in range(0, len(values), perline):
+        print("\t" + " ".join("%d," % v for v in values[i:i + perline]))
+    print("};\n")
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else "rowcolumn-diacritics.txt"
+    diacritics = readdiacritics(path)
+
+    records, props = {}, []
+    for cp in range(MAXRUNE):
+        rec = (width(cp), unicodedata.combining(chr(cp)),
+               diacritics.get(cp, 0))
+        if rec not in records:
+            records[rec] = len(records)
+        props.append(records[rec])
+    # uniprop() returns the first record for runes out of range
+    assert min(records, key=records.get) == (1, 0, 0)
+
+    shift = min(range(4, 12),
+                key=lambda s: tablebytes(*splittables(props, s)))
+    stage1, stage2 = splittables(props, shift)
+
+    print("/* See LICENSE for license details. */")
+    print("/*")
+    print(" * Generated by gen_unicode.py from Unicode %s and %s."
+          % (unicodedata.unidata_version, path))
+    print(" * Do not edit.")
+    print(" */")
+    print("#include <stdint.h>")
+    print("#include <wchar.h>\n")
+    print('#include "st.h"\n')
+    print("#define UNI_SHIFT %d" % shift)
+    print("#define UNI_MASK  ((1 << UNI_SHIFT) - 1)\n")
+    print("typedef struct {")
+    print("\tuchar width;")
+    print("\tuchar ccc;")
+    print("\tuint16_t diacritic;")
+    print("} UniProp;\n")
+    print("static const UniProp uniprops[] = {")
+    for rec in sorted(records, key=records.get):
+        print("\t{ %d, %d, %d }," % rec)
+    print("};\n")
+    emit("unistage1", ctype(stage1), stage1)
+    emit("unistage2", ctype(stage2), stage2)
+    print("""static const UniProp *
+uniprop(Rune u)
+{
+	if (u >= 0x%X)
+		return &uniprops[0];
+	return &uniprops[unistage2[(unistage1[u >> UNI_SHIFT] << UNI_SHIFT)
+	                           + (u & UNI_MASK)]];
+}
+
+int
+runewidth(Rune u)
+{
+	return uniprop(u)->width;
+}
+
+int
+runeccc(Rune u)
+{
+	return uniprop(u)->ccc;
+}
+
+uint16_t
+diacritic_to_num(uint32_t code)
+{
+	return uniprop(code)->diacritic;
+}""" % MAXRUNE)
+
+
+if __name__ == "__main__":
+    main()
@@ -37,6 +37,7 @@
 #include <X11/extensions/Xrender.h>
 #include <assert.h>
 #include <ctype.h>
+#include <dlfcn.h>
 #include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -51,6 +52,76 @@
 #include "khash.h"
 #include "kvec.h"
 
+////////////////////////////////////////////////////////////////////////////////
+// Lazily loaded libraries.
+////////////////////////////////////////////////////////////////////////////////
+
+/// Imlib2 and zlib are only needed once an image arrives, so they are opened
+/// with dlopen by the first graphics command instead of at every start. The
+/// members are named after the functions, which are redefined to use them.
+static struct {
+	void (*imlib_blend_image_onto_image)(Imlib_Image, char, int, int, int,
+					     int, int, int, int, int);
+	void (*imlib_context_set_anti_alias)(char);
+	void (*imlib_context_set_blend)(char);
+	void (*imlib_context_set_color)(int, int, int, int);
+	void (*imlib_context_set_colormap)(Colormap);
+	void (*imlib_context_set_display)(Display *);
+	void (*imlib_context_set_image)(Imlib_Image);
+	void (*imlib_context_set_visual)(Visual *);
+	Imlib_Image (*imlib_create_image)(int, int);
+	void (*imlib_free_image)(void);
+	void (*imlib_free_image_and_decache)(void);
+	void (*imlib_image_fill_rectangle)(int, int, int, int);
+	DATA32 *(*imlib_image_get_data)(void);
+	int (*imlib_image_get_height)(void);
+	int (*imlib_image_get_width)(void);
+	void (*imlib_image_put_back_data)(DATA32 *);
+	void (*imlib_image_set_has_alpha)(char);
+	Imlib_Image (*imlib_load_image)(const char *);
+	void (*imlib_set_cache_size)(int);
+	int (*inflate)(z_streamp, int);
+	int (*inflateEnd)(z_streamp);
+	int (*inflateInit_)(z_streamp, const char *, int);
+} lib;
+
+/// The names of the members of `lib`, in the same order.
+static const char *lib_symbols[] = {
+	"imlib_blend_image_onto_image", "imlib_context_set_anti_alias",
+	"imlib_context_set_blend", "imlib_context_set_color",
+	"imlib_context_set_colormap", "imlib_context_set_display",
+	"imlib_context_set_image", "imlib_context_set_visual",
+	"imlib_create_image", "imlib_free_image",
+	"imlib_free_image_and_decache", "imlib_image_fill_rectangle",
+	"imlib_image_get_data", "imlib_image_get_height",
+	"imlib_image_get_width", "imlib_image_put_back_data",
+	"imlib_image_set_has_alpha", "imlib_load_image",
+	"imlib_set_cache_size", "inflate", "inflateEnd", "inflateInit_",
+};
+
+#define imlib_blend_image_onto_image lib.imlib_blend_image_onto_image
+#define imlib_context_set_anti_alias lib.imlib_context_set_anti_alias
+#define imlib_context_set_blend lib.imlib_context_set_blend
+#define imlib_context_set_color lib.imlib_context_set_color
+#define imlib_context_set_colormap lib.imlib_context_set_colormap
+#define imlib_context_set_display lib.imlib_context_set_display
+#define imlib_context_set_image lib.imlib_context_set_image
+#define imlib_context_set_visual lib.imlib_context_set_visual
+#define imlib_create_image lib.imlib_create_image
+#define imlib_free_image lib.imlib_free_image
+#define imlib_free_image_and_decache lib.imlib_free_image_and_decache
+#define imlib_image_fill_rectangle lib.imlib_image_fill_rectangle
+#define imlib_image_get_data lib.imlib_image_get_data
+#define imlib_image_get_height lib.imlib_image_get_height
+#define imlib_image_get_width lib.imlib_image_get_width
+#define imlib_image_put_back_data lib.imlib_image_put_back_data
+#define imlib_image_set_has_alpha lib.imlib_image_set_has_alpha
+#define imlib_load_image lib.imlib_load_image
+#define imlib_set_cache_size lib.imlib_set_cache_size
+#define inflate lib.inflate
+#define inflateEnd lib.inflateEnd
+#define inflateInit_ lib.inflateInit_
+
 extern char **environ;
 
 #define MAX_FILENAME_SIZE 256
@@ -289,6 +360,8 @@ typedef struct ImagePlacement {
 	/// If true, do not move the cursor when displaying this placement
 	/// (non-virtual placements only).
 	char do_not_move_cursor;
+	/// Set by gr_unload_offscreen_images for placements shown on the screen.
+	char onscreen;
 } ImagePlacement;
 
 /// A rectangular piece of an image to be drawn.
@@ -381,6 +454,15 @@ static int this_redraw_cycle_loaded_pixmaps = 0;
 /// The directory where the cache files are stored.
 static char cache_dir[MAX_FILENAME_SIZE - 16];
 
+/// The X display, visual and colormap given to `gr_init`, and the drawable of
+/// the current redraw cycle.
+static Display *x_display;
+static Visual *x_visual;
+static Colormap x_colormap;
+static Drawable x_drawable;
+/// Whether the libraries are loaded: 0 not yet, 1 yes, -1 they failed to.
+static int libs_loaded = 0;
+
 /// The table used for color inversion.
 static unsigned char reverse_table[256];
 
@@ -630,7 +712,7 @@ static void gr_unload_placement(ImagePlacement *placement) {
 	unsigned placement_ram_size = gr_placement_current_ram_size(placement);
 	images_ram_size -= placement_ram_size;
 
-	Display *disp = imlib_context_get_display();
+	Display *disp = x_display;
 	foreach_pixmap(*placement, pixmap, {
 		if (pixmap)
 			XFreePixmap(disp, pixmap);
@@ -653,7 +735,7 @@ static void gr_unload_pixmap(ImagePlacement *placement, int frameidx) {
 	if (!pixmap)
 		return;
 
-	Display *disp = imlib_context_get_display();
+	Display *disp = x_display;
 	XFreePixmap(disp, pixmap);
 	gr_set_frame_pixmap(placement, frameidx, 0);
 	images_ram_size -= gr_placement_single_frame_ram_size(placement);
@@ -1346,6 +1428,43 @@ void gr_unload_images_to_reduce_ram() {
 	});
 }
 
+/// Marks the placement shown in an image cell as being on the screen.
+static int gr_mark_onscreen(void *data, uint32_t image_id,
+			    uint32_t placement_id, int col, int row,
+			    char is_classic) {
+	ImagePlacement *placement =
+		gr_find_image_and_placement(image_id, placement_id);
+	if (placement)
+		placement->onscreen = 1;
+	return 0;
+}
+
+int64_t gr_unload_offscreen_images() {
+	int64_t ram_size = images_ram_size;
+	Image *img = NULL;
+	ImagePlacement *placement = NULL;
+	kh_foreach_value(images, img, {
+		kh_foreach_value(img->placements, placement, {
+			placement->onscreen = 0;
+		});
+	});
+	gr_for_each_image_cell(gr_mark_onscreen, NULL);
+	kh_foreach_value(images, img, {
+		char shown = 0;
+		kh_foreach_value(img->placements, placement, {
+			if (placement->onscreen)
+				shown = 1;
+			else if (!placement->protected_frame)
+				gr_unload_placement(placement);
+		});
+		if (!shown)
+			gr_unload_all_frames(img);
+	});
+	GR_LOG("After unloading off-screen images: ram: %ld KiB\n",
+	       images_ram_size / 1024);
+	return ram_size - images_ram_size;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Image loading.
 ////////////////////////////////////////////////////////////////////////////////
@@ -1841,10 +1960,10 @@ Pixmap gr_load_pixmap(ImagePlacement *placement, int frameidx, int cw, int ch) {
 	gr_premultiply_alpha(data, scaled_w * scaled_h);
 
 	// Upload the image to the X server.
-	Display *disp = imlib_context_get_display();
-	Visual *vis = imlib_context_get_visual();
-	Colormap cmap = imlib_context_get_colormap();
-	Drawable drawable = imlib_context_get_drawable();
+	Display *disp = x_display;
+	Visual *vis = x_visual;
+	Colormap cmap = x_colormap;
+	Drawable drawable = x_drawable;
 	if (!drawable)
 		drawable = DefaultRootWindow(disp);
 	pixmap = XCreatePixmap(disp, drawable, scaled_w, scaled_h, 32);
@@ -1895,6 +2014,7 @@ static int gr_create_cache_dir() {
 			"error: could not create temporary dir from template "
 			"%s\n",
 			sanitized_filename(cache_dir));
+		cache_dir[0] = '\0';
 		return 0;
 	}
 	fprintf(stderr, "Graphics cache directory: %s\n", cache_dir);
@@ -1913,25 +2033,60 @@ static void gr_make_sure_tmpdir_exists() {
 	gr_create_cache_dir();
 }
 
-/// Initialize the graphics module.
-void gr_init(Display *disp, Visual *vis, Colormap cm) {
-	// Set the initialization time.
-	clock_gettime(CLOCK_MONOTONIC, &initialization_time);
+/// Opens Imlib2 and zlib, creates the cache dir and initializes imlib. Does
+/// it only once, and returns 0 if it failed.
+static int gr_load_libs() {
+	if (libs_loaded)
+		return libs_loaded > 0;
+	libs_loaded = -1;
+
+	void *imlib, *zlib;
+	if (!(imlib = dlopen("libImlib2.so.1", RTLD_NOW)) ||
+	    !(zlib = dlopen("libz.so.1", RTLD_NOW))) {
+		fprintf(stderr, "error: images are disabled: %s\n", dlerror());
+		return 0;
+	}
+	void **fn = (void **)&lib;
+	for (size_t i = 0; i < sizeof(lib_symbols) / sizeof(*lib_symbols);
+	     ++i) {
+		void *handle =
+			strncmp(lib_symbols[i], "imlib_", 6) ? zlib : imlib;
+		if (!(fn[i] = dlsym(handle, lib_symbols[i]))) {
+			fprintf(stderr, "error: images are disabled: %s\n",
+				dlerror());
+			return 0;
+		}
+	}
 
-	// Create the temporary dir.
+	// Create the temporary dir. Without it images are disabled, as when
+	// the libraries are missing; this runs in the middle of a session.
 	if (!gr_create_cache_dir())
-		abort();
+		return 0;
 
 	// Initialize imlib.
-	imlib_context_set_display(disp);
-	imlib_context_set_visual(vis);
-	imlib_context_set_colormap(cm);
+	imlib_context_set_display(x_display);
+	imlib_context_set_visual(x_visual);
+	imlib_context_set_colormap(x_colormap);
 	imlib_context_set_anti_alias(1);
 	imlib_context_set_blend(1);
 	// Imlib2 checks only the file name when caching, which is not enough
 	// for us since we reuse file names. Disable caching.
 	imlib_set_cache_size(0);
 
+	libs_loaded = 1;
+	return 1;
+}
+
+/// Initialize the graphics module. The libraries are loaded later, by the
+/// first command.
+void gr_init(Display *disp, Visual *vis, Colormap cm) {
+	// Set the initialization time.
+	clock_gettime(CLOCK_MONOTONIC, &initialization_time);
+
+	x_display = disp;
+	x_visual = vis;
+	x_colormap = cm;
+
 	// Prepare for color inversion.
 	for (size_t i = 0; i < 256; ++i)
 		reverse_table[i] = 255 - i;
@@ -1946,7 +2101,8 @@ void gr_init(Display *disp, Visual *vis, Colormap cm) {
 /// Deinitialize the graphics module.
 void gr_deinit() {
 	// Remove the cache dir.
-	remove(cache_dir);
+	if (cache_dir[0])
+		remove(cache_dir);
 	kv_destroy(next_redraw_times);
 	if (images) {
 		// Delete all images.
@@ -2268,7 +2424,7 @@ static void gr_displayinfo(Drawable buf, ImageRect *rect, int col1, int col2,
 			   const char *message) {
 	int w_pix = (rect->img_end_col - rect->img_start_col) * rect->cw;
 	int h_pix = (rect->img_end_row - rect->img_start_row) * rect->ch;
-	Display *disp = imlib_context_get_display();
+	Display *disp = x_display;
 	GC gc = XCreateGC(disp, buf, 0, NULL);
 	char info[MAX_INFO_LEN];
 	if (rect->placement_id)
@@ -2293,7 +2449,7 @@ static void gr_displayinfo(Drawable buf, ImageRect *rect, int col1, int col2,
 static void gr_showrect(Drawable buf, ImageRect *rect) {
 	int w_pix = (rect->img_end_col - rect->img_start_col) * rect->cw;
 	int h_pix = (rect->img_end_row - rect->img_start_row) * rect->ch;
-	Display *disp = imlib_context_get_display();
+	Display *disp = x_display;
 	GC gc = XCreateGC(disp, buf, 0, NULL);
 	XSetForeground(disp, gc, 0xFF00FF00);
 	XDrawRectangle(disp, buf, gc, rect->screen_x_pix, rect->screen_y_pix,
@@ -2374,8 +2530,8 @@ static void gr_drawimagerect(Drawable buf, ImageRect *rect) {
 	int dst_y = rect->screen_y_pix;
 
 	// Display the image.
-	Display *disp = imlib_context_get_display();
-	Visual *vis = imlib_context_get_visual();
+	Display *disp = x_display;
+	Visual *vis = x_visual;
 
 	// Create an xrender picture for the window.
 	XRenderPictFormat *win_format =
@@ -2445,7 +2601,7 @@ void gr_start_drawing(Drawable buf, int cw, int ch) {
 	this_redraw_cycle_loaded_files = 0;
 	this_redraw_cycle_loaded_pixmaps = 0;
 	drawing_start_time = gr_now_ms();
-	imlib_context_set_drawable(buf);
+	x_drawable = buf;
 }
 
 /// Finish image drawing. This functions will draw all the rectangles left to
@@ -2478,7 +2634,7 @@ void gr_finish_drawing(Drawable buf) {
 	if (graphics_debug_mode) {
 		int milliseconds = drawing_end_time - drawing_start_time;
 
-		Display *disp = imlib_context_get_display();
+		Display *disp = x_display;
 		GC gc = XCreateGC(disp, buf, 0, NULL);
 		const char *debug_mode_str =
 			graphics_debug_mode == GRAPHICS_DEBUG_LOG_AND_BOXES
@@ -3729,6 +3885,8 @@ int gr_parse_command(char *buf, size_t len) {
 	if (cmd.payload && cmd.payload[0])
 		GR_LOG("    payload size: %ld\n", strlen(cmd.payload));
 
+	if (!graphics_command_result.error && !gr_load_libs())
+		gr_reporterror_cmd(&cmd, "ENOTSUP: images are disabled");
 	if (!graphics_command_result.error)
 		gr_handle_command(&cmd);
 
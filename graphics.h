@@ -54,6 +54,11 @@ void gr_dump_state();
 /// Unloads images to reduce RAM usage.
 void gr_unload_images_to_reduce_ram();
 
+/// Unloads the pixmaps of placements that are not on the screen and the
+/// frames of images that have no placement on the screen. Returns the number
+/// of bytes released.
+int64_t gr_unload_offscreen_images();
+
 /// Executes `callback` for each image cell. `callback` may return 1 to erase
 /// the cell or 0 to keep it. This function is implemented in `st.c`.
 void gr_for_each_image_cell(int (*callback)(void *data, uint32_t image_id,
@@ -0,0 +1,159 @@
+/* See LICENSE for license details. */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+#include <hb.h>
+#include <hb-ft.h>
+
+#include "st.h"
+#include "hb.h"
+
+#define RUNCACHESIZE	1024 /* must be a power of two */
+
+typedef struct {
+	XftFont *xfont;
+	hb_font_t *font;
+	FT_UInt space;
+} HbFont;
+
+/* glyphs and offsets of one shaped run, one per cell */
+typedef struct {
+	uint32_t hash;
+	XftFont *xfont;
+	int len;
+	Rune *runes;
+	FT_UInt *glyphs;
+	short *xoff;
+} ShapedRun;
+
+static HbFont *hbfind(XftFont *);
+static uint32_t runhash(XftFont *, const Rune *, int);
+static void shaperun(ShapedRun *);
+
+static HbFont *hbfonts = NULL;
+static int nhbfonts = 0;
+static int hbfontscap = 0;
+static hb_buffer_t *hbbuf = NULL;
+static ShapedRun runcache[RUNCACHESIZE];
+
+HbFont *
+hbfind(XftFont *xfont)
+{
+	FT_Face face;
+	hb_codepoint_t space;
+	int i;
+
+	for (i = 0; i < nhbfonts; i++) {
+		if (hbfonts[i].xfont == xfont)
+			return &hbfonts[i];
+	}
+
+	if (nhbfonts >= hbfontscap) {
+		hbfontscap += 8;
+		hbfonts = xrealloc(hbfonts, hbfontscap * sizeof(*hbfonts));
+	}
+
+	/* the face stays locked for as long as HarfBuzz uses it */
+	face = XftLockFace(xfont);
+	hbfonts[i].xfont = xfont;
+	hbfonts[i].font = hb_ft_font_create(face, NULL);
+	if (!hb_font_get_nominal_glyph(hbfonts[i].font, ' ', &space))
+		space = 0;
+	hbfonts[i].space = space;
+	nhbfonts++;
+
+	return &hbfonts[i];
+}
+
+void
+hbunloadfonts(void)
+{
+	int i;
+
+	for (i = 0; i < RUNCACHESIZE; i++) {
+		free(runcache[i].runes);
+		memset(&runcache[i], 0, sizeof(runcache[i]));
+	}
+	for (i = 0; i < nhbfonts; i++) {
+		hb_font_destroy(hbfonts[i].font);
+		XftUnlockFace(hbfonts[i].xfont);
+	}
+	nhbfonts = 0;
+}
+
+uint32_t
+runhash(XftFont *xfont, const Rune *runes, int len)
+{
+	uint32_t h = 2166136261u ^ (uint32_t)(uintptr_t)xfont;
+	int i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ runes[i]) * 16777619u;
+	return h;
+}
+
+/*
+ * Shapes r->runes left to right. Each cell gets the first glyph of the
+ * cluster it starts; cells swallowed by a ligature get a space, so that the
+ * run keeps one glyph per cell.
+ */
+void
+shaperun(ShapedRun *r)
+{
+	HbFont *hf = hbfind(r->xfont);
+	hb_glyph_info_t *info;
+	hb_glyph_position_t *pos;
+	unsigned int i, n, c;
+
+	if (!hbbuf)
+		hbbuf = hb_buffer_create();
+	hb_buffer_clear_contents(hbbuf);
+	hb_buffer_set_direction(hbbuf, HB_DIRECTION_LTR);
+	hb_buffer_add_utf32(hbbuf, r->runes, r->len, 0, r->len);
+	hb_buffer_guess_segment_properties(hbbuf);
+	hb_shape(hf->font, hbbuf, NULL, 0);
+
+	info = hb_buffer_get_glyph_infos(hbbuf, &n);
+	pos = hb_buffer_get_glyph_positions(hbbuf, NULL);
+
+	for (i = 0; i < r->len; i++) {
+		r->glyphs[i] = hf->space;
+		r->xoff[i] = 0;
+	}
+	for (i = 0; i < n; i++) {
+		c = info[i].cluster;
+		if (c >= r->len || (i > 0 && info[i - 1].cluster == c))
+			continue;
+		r->glyphs[c] = info[i].codepoint;
+		r->xoff[c] = pos[i].x_offset / 64;
+	}
+}
+
+void
+hbshape(XftFont *xfont, const Rune *runes, int len, FT_UInt *glyphs,
+		short *xoff)
+{
+	uint32_t h = runhash(xfont, runes, len);
+	ShapedRun *r = &runcache[h & (RUNCACHESIZE - 1)];
+
+	if (r->hash != h || r->xfont != xfont || r->len != len ||
+			memcmp(r->runes, runes, len * sizeof(Rune))) {
+		if (r->len < len) {
+			free(r->runes);
+			r->runes = xmalloc(len * (sizeof(Rune) +
+					sizeof(FT_UInt) + sizeof(short)));
+		}
+		r->hash = h;
+		r->xfont = xfont;
+		r->len = len;
+		r->glyphs = (FT_UInt *)(r->runes + len);
+		r->xoff = (short *)(r->glyphs + len);
+		memcpy(r->runes, runes, len * sizeof(Rune));
+		shaperun(r);
+	}
+
+	memcpy(glyphs, r->glyphs, len * sizeof(FT_UInt));
+	memcpy(xoff, r->xoff, len * sizeof(short));
+}
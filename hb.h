@@ -0,0 +1,10 @@
+/* See LICENSE for license details. */
+
+/*
+ * Text shaping with HarfBuzz, for ligatures and complex scripts. Shaped runs
+ * are cached by font and text, so that a run is only shaped again when its
+ * content changes. Needs Xft declared beforehand.
+ */
+
+void hbshape(XftFont *, const Rune *, int, FT_UInt *, short *);
+void hbunloadfonts(void);
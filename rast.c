@@ -0,0 +1,573 @@
+/* See LICENSE for license details. */
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include <X11/Xft/Xft.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_SYNTHESIS_H
+
+#include "st.h"
+#include "khash.h"
+#include "rast.h"
+
+#define MAXDAMAGE	64
+
+typedef struct {
+	short left, top; /* bitmap offset from the pen position */
+	ushort w, h;
+	int color;       /* pixels are premultiplied ARGB, not coverage */
+	void *pixels;
+} RastGlyph;
+
+KHASH_MAP_INIT_INT64(glyphs, RastGlyph)
+
+static int channel(ulong, int *);
+static int shmhandler(Display *, XErrorEvent *);
+static int newimage(int, int);
+static void freeimage(void);
+static void waitserver(void);
+static void damage(int, int, int, int);
+static int cliprect(int *, int *, int *, int *);
+static int fontid(XftFont *);
+static int loadflags(FcPattern *);
+static void copybitmap(RastGlyph *, FT_Bitmap *, double);
+static void loadglyph(RastGlyph *, XftFont *, FT_UInt);
+static RastGlyph *getglyph(XftFont *, FT_UInt);
+
+static Display *dpy;
+static Visual *vis;
+static int depth;
+static Drawable target;
+static GC gc;
+
+static XImage *img;
+static char *saved; /* copy of img->data, see rast_save() */
+static XShmSegmentInfo shminfo;
+static int useshm, shmbusy, shmerror;
+static int rshift, gshift, bshift;
+static uint32_t rgbmask;
+
+static int clipx1, clipy1, clipx2, clipy2;
+static XRectangle damaged[MAXDAMAGE];
+static int ndamaged;
+
+static khash_t(glyphs) *cache;
+static XftFont **fonts;
+static int nfonts, fontscap;
+
+int
+channel(ulong mask, int *shift)
+{
+	for (*shift = 0; *shift <= 24; (*shift)++) {
+		if (mask == 0xffUL << *shift)
+			return 1;
+	}
+	return 0;
+}
+
+int
+shmhandler(Display *d, XErrorEvent *e)
+{
+	shmerror = 1;
+	return 0;
+}
+
+int
+newimage(int w, int h)
+{
+	int (*handler)(Display *, XErrorEvent *);
+
+	if (useshm) {
+		img = XShmCreateImage(dpy, vis, depth, ZPixmap, NULL, &shminfo,
+		                      w, h);
+		if (img && img->bits_per_pixel == 32) {
+			shminfo.shmid = shmget(IPC_PRIVATE,
+			                       img->bytes_per_line * h,
+			                       IPC_CREAT | 0600);
+			if (shminfo.shmid != -1) {
+				shminfo.shmaddr = img->data = shmat(shminfo.shmid,
+				                                    NULL, 0);
+				shminfo.readOnly = False;
+
+				/* remote displays fail to attach */
+				shmerror = shminfo.shmaddr == (char *)-1;
+				if (!shmerror) {
+					handler = XSetErrorHandler(shmhandler);
+					XShmAttach(dpy, &shminfo);
+					XSync(dpy, False);
+					XSetErrorHandler(handler);
+				}
+				shmctl(shminfo.shmid, IPC_RMID, NULL);
+				if (!shmerror)
+					return 1;
+				if (shminfo.shmaddr != (char *)-1)
+					shmdt(shminfo.shmaddr);
+			}
+			img->data = NULL;
+		}
+		if (img)
+			XDestroyImage(img);
+		useshm = 0;
+	}
+
+	img = XCreateImage(dpy, vis, depth, ZPixmap, 0, NULL, w, h, 32, 0);
+	if (!img)
+		return 0;
+	if (img->bits_per_pixel != 32) {
+		XDestroyImage(img);
+		img = NULL;
+		return 0;
+	}
+	img->data = xmalloc(img->bytes_per_line * h);
+	return 1;
+}
+
+void
+freeimage(void)
+{
+	if (useshm) {
+		XShmDetach(dpy, &shminfo);
+		shmdt(shminfo.shmaddr);
+		img->data = NULL;
+	}
+	XDestroyImage(img);
+	img = NULL;
+	free(saved);
+	saved = NULL;
+}
+
+/* The server reads shared images asynchronously. */
+void
+waitserver(void)
+{
+	if (shmbusy) {
+		XSync(dpy, False);
+		shmbusy = 0;
+	}
+}
+
+void
+damage(int x, int y, int w, int h)
+{
+	XRectangle *r;
+	int i;
+
+	for (i = 0; i < ndamaged; i++) {
+		r = &damaged[i];
+		if (x >= r->x && x + w <= r->x + r->width &&
+		    y >= r->y && y + h <= r->y + r->height)
+			return;
+		/* grow rectangles on the same band or column they touch */
+		if (y == r->y && h == r->height &&
+		    x <= r->x + r->width && x + w >= r->x) {
+			r->width = MAX(x + w, r->x + r->width) - MIN(x, r->x);
+			r->x = MIN(x, r->x);
+			return;
+		}
+		if (x == r->x && w == r->width &&
+		    y <= r->y + r->height && y + h >= r->y) {
+			r->height = MAX(y + h, r->y + r->height) - MIN(y, r->y);
+			r->y = MIN(y, r->y);
+			return;
+		}
+	}
+
+	/*
+	 * Send what we have rather than merging unrelated rectangles: pixels
+	 * outside of the damage may be stale, e.g. under images.
+	 */
+	if (ndamaged == MAXDAMAGE)
+		rast_present();
+	damaged[ndamaged++] = (XRectangle){ x, y, w, h };
+}
+
+/* Clips a rectangle to the image and the clip rectangle. */
+int
+cliprect(int *x, int *y, int *w, int *h)
+{
+	int x1 = MAX(*x, clipx1), y1 = MAX(*y, clipy1);
+	int x2 = MIN(*x + *w, clipx2), y2 = MIN(*y + *h, clipy2);
+
+	x1 = MAX(x1, 0);
+	y1 = MAX(y1, 0);
+	x2 = MIN(x2, img->width);
+	y2 = MIN(y2, img->height);
+	if (x1 >= x2 || y1 >= y2)
+		return 0;
+	*x = x1;
+	*y = y1;
+	*w = x2 - x1;
+	*h = y2 - y1;
+	return 1;
+}
+
+int
+fontid(XftFont *font)
+{
+	int i;
+
+	for (i = 0; i < nfonts; i++) {
+		if (fonts[i] == font)
+			return i;
+	}
+	if (nfonts == fontscap) {
+		fontscap += 16;
+		fonts = xrealloc(fonts, fontscap * sizeof(*fonts));
+	}
+	fonts[nfonts] = font;
+	return nfonts++;
+}
+
+/* Approximates the load flags Xft derives from the font pattern. */
+int
+loadflags(FcPattern *pattern)
+{
+	FcBool antialias = FcTrue, hinting = FcTrue, autohint = FcFalse;
+	int hintstyle = FC_HINT_FULL, flags = FT_LOAD_DEFAULT;
+
+	FcPatternGetBool(pattern, FC_ANTIALIAS, 0, &antialias);
+	FcPatternGetBool(pattern, FC_HINTING, 0, &hinting);
+	FcPatternGetBool(pattern, FC_AUTOHINT, 0, &autohint);
+	FcPatternGetInteger(pattern, FC_HINT_STYLE, 0, &hintstyle);
+
+	if (!antialias)
+		flags |= FT_LOAD_TARGET_MONO;
+	else if (!hinting || hintstyle == FC_HINT_NONE)
+		flags |= FT_LOAD_NO_HINTING;
+	else if (hintstyle == FC_HINT_SLIGHT)
+		flags |= FT_LOAD_TARGET_LIGHT;
+	if (autohint)
+		flags |= FT_LOAD_FORCE_AUTOHINT;
+	return flags;
+}
+
+/* Copies a bitmap, downscaling color bitmaps that come in fixed sizes. */
+void
+copybitmap(RastGlyph *g, FT_Bitmap *bm, double scale)
+{
+	uchar *row, *dst;
+	uint32_t *cdst;
+	uint32_t sum[4];
+	int x, y, sx, sy, sx1, sy1, sx2, sy2, n, i;
+
+	g->w = bm->width;
+	g->h = bm->rows;
+	if (bm->pixel_mode != FT_PIXEL_MODE_BGRA) {
+		g->pixels = dst = xmalloc(g->w * g->h);
+		for (y = 0; y < g->h; y++) {
+			row = bm->buffer + (bm->pitch >= 0 ? y : y - g->h + 1)
+			      * bm->pitch;
+			for (x = 0; x < g->w; x++, dst++) {
+				if (bm->pixel_mode == FT_PIXEL_MODE_MONO)
+					*dst = (row[x >> 3] & 0x80 >> (x & 7)) ? 255 : 0;
+				else
+					*dst = row[x];
+			}
+		}
+		return;
+	}
+
+	g->color = 1;
+	if (scale > 1)
+		scale = 1;
+	g->w = ceil(bm->width * scale);
+	g->h = ceil(bm->rows * scale);
+	g->left *= scale;
+	g->top *= scale;
+	g->pixels = cdst = xmalloc(g->w * g->h * sizeof(uint32_t));
+	for (y = 0; y < g->h; y++) {
+		sy1 = y / scale;
+		sy2 = MIN(MAX((int)((y + 1) / scale), sy1 + 1), (int)bm->rows);
+		for (x = 0; x < g->w; x++, cdst++) {
+			sx1 = x / scale;
+			sx2 = MIN(MAX((int)((x + 1) / scale), sx1 + 1),
+			          (int)bm->width);
+			/* box filter over the source pixels, BGRA order */
+			memset(sum, 0, sizeof(sum));
+			for (n = 0, sy = sy1; sy < sy2; sy++) {
+				row = bm->buffer + (bm->pitch >= 0 ? sy :
+				      sy - (int)bm->rows + 1) * bm->pitch;
+				for (sx = sx1; sx < sx2; sx++, n++) {
+					for (i = 0; i < 4; i++)
+						sum[i] += row[sx * 4 + i];
+				}
+			}
+			if (n == 0)
+				n = 1;
+			*cdst = (sum[3] / n) << 24 | (sum[2] / n) << 16 |
+			        (sum[1] / n) << 8 | (sum[0] / n);
+		}
+	}
+}
+
+void
+loadglyph(RastGlyph *g, XftFont *font, FT_UInt idx)
+{
+	FT_Face face;
+	FT_GlyphSlot slot;
+	FcBool embolden = FcFalse;
+	int flags;
+	double scale = 1;
+
+	memset(g, 0, sizeof(*g));
+	if (!(face = XftLockFace(font)))
+		return;
+	slot = face->glyph;
+
+	flags = loadflags(font->pattern);
+	if (FT_HAS_COLOR(face))
+		flags |= FT_LOAD_COLOR;
+	if (FT_Load_Glyph(face, idx, flags))
+		goto unlock;
+
+	FcPatternGetBool(font->pattern, FC_EMBOLDEN, 0, &embolden);
+	if (embolden && slot->format == FT_GLYPH_FORMAT_OUTLINE)
+		FT_GlyphSlot_Embolden(slot);
+	if (slot->format != FT_GLYPH_FORMAT_BITMAP &&
+	    FT_Render_Glyph(slot, (flags & FT_LOAD_TARGET_MONO) ?
+	                    FT_RENDER_MODE_MONO : FT_RENDER_MODE_NORMAL))
+		goto unlock;
+	if (slot->bitmap.pixel_mode != FT_PIXEL_MODE_MONO &&
+	    slot->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY &&
+	    slot->bitmap.pixel_mode != FT_PIXEL_MODE_BGRA)
+		goto unlock;
+
+	if (slot->bitmap.pixel_mode == FT_PIXEL_MODE_BGRA &&
+	    face->size->metrics.height > 0)
+		scale = font->height / (face->size->metrics.height / 64.0);
+	g->left = slot->bitmap_left;
+	g->top = slot->bitmap_top;
+	copybitmap(g, &slot->bitmap, scale);
+
+unlock:
+	XftUnlockFace(font);
+}
+
+RastGlyph *
+getglyph(XftFont *font, FT_UInt idx)
+{
+	khint_t k;
+	uint64_t key;
+	int ret;
+
+	key = (uint64_t)fontid(font) << 32 | idx;
+	k = kh_get(glyphs, cache, key);
+	if (k == kh_end(cache)) {
+		k = kh_put(glyphs, cache, key, &ret);
+		loadglyph(&kh_val(cache, k), font, idx);
+	}
+	return &kh_val(cache, k);
+}
+
+/* public API */
+
+int
+rast_init(Display *d, Visual *v, int dep, Drawable buf, GC g, int w, int h)
+{
+	if (v->class != TrueColor || !channel(v->red_mask, &rshift) ||
+	    !channel(v->green_mask, &gshift) || !channel(v->blue_mask, &bshift))
+		return 0;
+
+	dpy = d;
+	vis = v;
+	depth = dep;
+	target = buf;
+	gc = g;
+	rgbmask = v->red_mask | v->green_mask | v->blue_mask;
+	useshm = XShmQueryExtension(dpy);
+	if (!newimage(w, h))
+		return 0;
+	cache = kh_init(glyphs);
+	rast_unsetclip();
+	return 1;
+}
+
+void
+rast_resize(Drawable buf, int w, int h)
+{
+	waitserver();
+	freeimage();
+	if (!newimage(w, h))
+		die("could not create a %dx%d image\n", w, h);
+	target = buf;
+	ndamaged = 0;
+	rast_unsetclip();
+}
+
+void
+rast_setclip(int x, int y, int w, int h)
+{
+	clipx1 = x;
+	clipy1 = y;
+	clipx2 = x + w;
+	clipy2 = y + h;
+}
+
+void
+rast_unsetclip(void)
+{
+	clipx1 = clipy1 = 0;
+	clipx2 = clipy2 = INT_MAX;
+}
+
+void
+rast_fill(const XftColor *color, int x, int y, int w, int h)
+{
+	uint32_t *p, *end;
+	int i;
+
+	if (!cliprect(&x, &y, &w, &h))
+		return;
+	waitserver();
+	for (i = 0; i < h; i++) {
+		p = (uint32_t *)(img->data + (y + i) * img->bytes_per_line) + x;
+		for (end = p + w; p < end; p++)
+			*p = color->pixel;
+	}
+	damage(x, y, w, h);
+}
+
+void
+rast_glyphs(const XftColor *color, const XftGlyphFontSpec *specs, int len)
+{
+	RastGlyph *g;
+	uint32_t *p, d, s;
+	uchar *a;
+	int fr = color->color.red >> 8, fg = color->color.green >> 8,
+	    fb = color->color.blue >> 8;
+	int i, gx, gy, x, y, w, h, cx, cy, dr, dg, db, sa;
+
+	waitserver();
+	for (i = 0; i < len; i++) {
+		g = getglyph(specs[i].font, specs[i].glyph);
+		gx = specs[i].x + g->left;
+		gy = specs[i].y - g->top;
+		x = gx;
+		y = gy;
+		w = g->w;
+		h = g->h;
+		if (!w || !cliprect(&x, &y, &w, &h))
+			continue;
+
+		for (cy = y; cy < y + h; cy++) {
+			p = (uint32_t *)(img->data + cy * img->bytes_per_line) + x;
+			for (cx = x; cx < x + w; cx++, p++) {
+				d = *p;
+				dr = (d >> rshift) & 0xff;
+				dg = (d >> gshift) & 0xff;
+				db = (d >> bshift) & 0xff;
+				if (g->color) {
+					s = ((uint32_t *)g->pixels)[(cy - gy) * g->w + cx - gx];
+					if (!(sa = s >> 24))
+						continue;
+					dr = ((s >> 16) & 0xff) + dr * (255 - sa) / 255;
+					dg = ((s >> 8) & 0xff) + dg * (255 - sa) / 255;
+					db = (s & 0xff) + db * (255 - sa) / 255;
+				} else {
+					a = (uchar *)g->pixels + (cy - gy) * g->w + cx - gx;
+					if (!*a)
+						continue;
+					if (*a == 255) {
+						*p = color->pixel;
+						continue;
+					}
+					dr += (fr - dr) * *a / 255;
+					dg += (fg - dg) * *a / 255;
+					db += (fb - db) * *a / 255;
+				}
+				*p = (d & ~rgbmask) | (uint32_t)dr << rshift |
+				     (uint32_t)dg << gshift | (uint32_t)db << bshift;
+			}
+		}
+		damage(x, y, w, h);
+	}
+}
+
+/* Moves the rows [y, y + h) by dy, as the target was blitted the same way. */
+void
+rast_scroll(int y, int h, int dy)
+{
+	waitserver();
+	memmove(img->data + (y + dy) * img->bytes_per_line,
+	        img->data + y * img->bytes_per_line,
+	        (size_t)h * img->bytes_per_line);
+}
+
+void
+rast_save(void)
+{
+	size_t n = (size_t)img->bytes_per_line * img->height;
+
+	if (!saved)
+		saved = xmalloc(n);
+	memcpy(saved, img->data, n);
+}
+
+/* Frees the copy of rast_save(), returns its size. */
+size_t
+rast_dropsaved(void)
+{
+	size_t n = saved ? (size_t)img->bytes_per_line * img->height : 0;
+
+	free(saved);
+	saved = NULL;
+	return n;
+}
+
+/*
+ * Puts back the pixels of rast_save(), returns 0 if there are none. The
+ * target is not damaged: the caller puts back its own copy of it, which
+ * also holds the images.
+ */
+int
+rast_restore(void)
+{
+	if (!saved)
+		return 0;
+	waitserver();
+	memcpy(img->data, saved, (size_t)img->bytes_per_line * img->height);
+	return 1;
+}
+
+void
+rast_present(void)
+{
+	XRectangle *r;
+	int i;
+
+	for (i = 0; i < ndamaged; i++) {
+		r = &damaged[i];
+		if (useshm) {
+			XShmPutImage(dpy, target, gc, img, r->x, r->y,
+			             r->x, r->y, r->width, r->height, False);
+		} else {
+			XPutImage(dpy, target, gc, img, r->x, r->y,
+			          r->x, r->y, r->width, r->height);
+		}
+	}
+	shmbusy = useshm && ndamaged > 0;
+	ndamaged = 0;
+}
+
+/* Must be called before the fonts are closed. */
+void
+rast_dropglyphs(void)
+{
+	khint_t k;
+
+	for (k = kh_begin(cache); k != kh_end(cache); k++) {
+		if (kh_exist(cache, k))
+			free(kh_val(cache, k).pixels);
+	}
+	kh_clear(glyphs, cache);
+	nfonts = 0;
+}
@@ -0,0 +1,20 @@
+/* See LICENSE for license details. */
+
+/*
+ * Client-side rasterizer. Cells are drawn into an XImage, shared with the
+ * server through MIT-SHM when possible, and only the damaged rectangles are
+ * sent to the target drawable. Needs Xlib and Xft declared beforehand.
+ */
+
+int rast_init(Display *, Visual *, int, Drawable, GC, int, int);
+void rast_resize(Drawable, int, int);
+void rast_setclip(int, int, int, int);
+void rast_unsetclip(void);
+void rast_fill(const XftColor *, int, int, int, int);
+void rast_glyphs(const XftColor *, const XftGlyphFontSpec *, int);
+void rast_scroll(int, int, int);
+void rast_save(void);
+int rast_restore(void);
+size_t rast_dropsaved(void);
+void rast_present(void);
+void rast_dropglyphs(void);
@@ -14,12 +14,14 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 
 #include "st.h"
 #include "win.h"
 #include "graphics.h"
+#include "khash.h"
 
 #if   defined(__linux)
  #include <pty.h>
@@ -37,6 +39,9 @@
 #define STR_BUF_SIZ   ESC_BUF_SIZ
 #define STR_ARG_SIZ   ESC_ARG_SIZ
 
+/* Cells with ATTR_COMBINING store CLUSTER_BASE + the cluster offset in u */
+#define CLUSTER_BASE  0x110000
+
 /* PUA character used as an image placeholder */
 #define IMAGE_PLACEHOLDER_CHAR 0x10EEEE
 #define IMAGE_PLACEHOLDER_CHAR_OLD 0xEEEE
@@ -46,6 +51,7 @@
 #define ISCONTROLC0(c)		(BETWEEN(c, 0, 0x1f) || (c) == 0x7f)
 #define ISCONTROLC1(c)		(BETWEEN(c, 0x80, 0x9f))
 #define ISCONTROL(c)		(ISCONTROLC0(c) || ISCONTROLC1(c))
+#define PREDICT_MAX		64
 #define ISDELIM(u)		(u && wcschr(worddelimiters, u))
 
 #define TSCREEN term.screen[IS_SET(MODE_ALTSCREEN)]
@@ -60,6 +66,7 @@ enum term_mode {
 	MODE_ECHO        = 1 << 4,
 	MODE_PRINT       = 1 << 5,
 	MODE_UTF8        = 1 << 6,
+	MODE_LRMARGIN    = 1 << 7,
 };
 
 enum cursor_movement {
@@ -124,9 +131,17 @@ typedef struct {
 	int size;      /* size of buffer */
 	int cur;       /* start of active screen */
 	int off;       /* scrollback line offset */
+	int64_t base;  /* number of the line at cur, counting from the first */
 	TCursor sc;    /* saved cursor */
 } LineBuffer;
 
+/* Shell integration mark (OSC 133) */
+typedef struct {
+	int64_t line;  /* line number, see LineBuffer.base */
+	short col;
+	char type;     /* 'A' prompt, 'B' command, 'C' output, 'D' finished */
+} Mark;
+
 /* Internal representation of the screen */
 typedef struct {
 	int row;      /* nb row */
@@ -136,11 +151,17 @@ typedef struct {
 	LineBuffer screen[2]; /* screen and alternate screen */
 	int linelen;  /* allocated line length */
 	int *dirty;   /* dirtyness of lines */
+	Glyph *shadow; /* cells as last drawn, term.col per row */
+	int *drawn;   /* rows of shadow that hold what is on the window */
+	int viewshift; /* rows the view moved down since the last draw */
+	int primarycy; /* cursor row in the kept primary screen, -1 if none */
 	TCursor c;    /* cursor */
 	int ocx;      /* old cursor col */
 	int ocy;      /* old cursor row */
 	int top;      /* top    scroll limit */
 	int bot;      /* bottom scroll limit */
+	int left;     /* left scroll limit */
+	int right;    /* right scroll limit */
 	int mode;     /* terminal mode flags */
 	int esc;      /* escape state flags */
 	char trantbl[4]; /* charset table translation */
@@ -150,6 +171,13 @@ typedef struct {
 	Rune lastc;   /* last printed char outside of sequence, 0 if control */
 } Term;
 
+/* A key drawn before the shell echoes it, see predicttimeout */
+typedef struct {
+	Rune u;
+	int x;
+	struct timespec t;
+} Prediction;
+
 /* CSI Escape sequence structs */
 /* ESC '[' [[ [<priv>] <arg> [;]] <mode> [<mode>]] */
 typedef struct {
@@ -192,6 +220,8 @@ static void tprinter(char *, size_t);
 static void tdumpsel(void);
 static void tdumpline(int);
 static void tdump(void);
+static void texport(const char *);
+static void texportsgr(FILE *, const Glyph *);
 static void tclearregion(int, int, int, int);
 static void tcursor(int);
 static void tdeletechar(int);
@@ -209,12 +239,29 @@ static void tscrollup(int, int);
 static void tscrolldown(int, int);
 static void tsetattr(const int *, int);
 static void tsetchar(Rune, const Glyph *, int, int);
+static void tappendmark(Glyph *, Rune);
+static Rune tbaserune(const Glyph *);
 static void tsetdirt(int, int);
 static void tsetscroll(int, int);
+static void tsetmargins(int, int);
+static void tscrollrect(int, int);
+static void tbreakwide(int, int);
 static void tswapscreen(void);
 static void tsetmode(int, int, const int *, int);
 static int twrite(const char *, int, int);
+static void tpinview(int64_t, const Selection *);
+static Line tpredictline(void);
+static int tpredictrow(void);
+static void tpredictdirty(void);
+static Line tpredictover(Line, int);
+static void tpredict(const char *, size_t);
+static void tpredictsettle(void);
+static int tpredictcursor(void);
 static void tfulldirt(void);
+static void tscrollshadow(int);
+static void tmark(char);
+static int markfind(int64_t);
+static void tscrollview(int);
 static void tcontrolcode(uchar );
 static void tdectest(char );
 static void tdefutf8(char);
@@ -223,6 +270,11 @@ static void tdeftran(char);
 static void tstrsequence(uchar);
 
 static void drawregion(int, int, int, int);
+static void drawdiff(Line, int, int, int);
+static int drawspan(Line, int, int, int);
+#ifdef HARFBUZZ
+static int shaperun(Line, int, int);
+#endif
 static void clearline(Line, Glyph, int, int);
 static Line ensureline(Line);
 
@@ -239,24 +291,46 @@ static char base64dec_getc(const char **);
 
 static ssize_t xwrite(int, const char *, size_t);
 
+static khint32_t clusterhash(uint32_t);
+static int clustereq(uint32_t, uint32_t);
+static Rune clusterintern(const Rune *, int);
+static size_t clustercompact(void);
+
+KHASH_INIT(clusters, uint32_t, char, 0, clusterhash, clustereq)
+
 /* Globals */
 static Term term;
 static Selection sel;
+static Mark *marks; /* of the main screen, ordered by line */
+static int nmarks, markscap;
 static CSIEscape csiescseq;
+static Prediction preds[PREDICT_MAX];
+static int npreds;
+static int64_t predline; /* number of the line, see LineBuffer.base */
+static int predalt;      /* the guesses are on the alternate screen */
+static int predtrusted;  /* the last output echoed a guess, they are shown */
+static int predblocked;  /* the cursor moves in ways not guessed */
+static Glyph *predover;  /* line with the guesses drawn over it */
+static int predoverlen;
 static STREscape strescseq;
 static int iofd = 1;
 static int cmdfd;
 static pid_t pid;
 
+/*
+ * Interned grapheme clusters (a base rune followed by combining marks). The
+ * pool holds the length of each cluster followed by its runes, so plain cells
+ * cost nothing and identical clusters are stored once.
+ */
+static Rune *clusterpool;
+static size_t clusterpoollen, clusterpoolcap;
+static khash_t(clusters) *clusterset;
+
 static const uchar utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const uchar utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
 static const Rune utfmin[UTF_SIZ + 1] = {       0,    0,  0x80,  0x800,  0x10000};
 static const Rune utfmax[UTF_SIZ + 1] = {0x10FFFF, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
 
-/* Converts a diacritic to a row/column/etc number. The result is 1-base, 0
- * means "couldn't convert". Defined in rowcolumn_diacritics_helpers.c */
-uint16_t diacritic_to_num(uint32_t code);
-
 ssize_t
 xwrite(int fd, const char *s, size_t len)
 {
@@ -548,7 +622,7 @@ selsnap(int *x, int *y, int direction)
 		 * beginning of a line.
 		 */
 		prevgp = &TLINE(*y)[*x];
-		prevdelim = ISDELIM(prevgp->u);
+		prevdelim = ISDELIM(tbaserune(prevgp));
 		for (;;) {
 			newx = *x + direction;
 			newy = *y;
@@ -570,7 +644,7 @@ selsnap(int *x, int *y, int direction)
 				break;
 
 			gp = &TLINE(newy)[newx];
-			delim = ISDELIM(gp->u);
+			delim = ISDELIM(tbaserune(gp));
 			if (!(gp->mode & ATTR_WDUMMY) && (delim != prevdelim
 					|| (delim && gp->u != prevgp->u)))
 				break;
@@ -611,8 +685,9 @@ char *
 getsel(void)
 {
 	char *str, *ptr;
-	int y, bufsize, lastx, linelen;
+	int y, bufsize, lastx, linelen, i, len;
 	const Glyph *gp, *last;
+	const Rune *cluster;
 
 	if (sel.ob.x == -1)
 		return NULL;
@@ -648,6 +723,18 @@ getsel(void)
 				continue;
 			}
 
+			if (gp->mode & ATTR_COMBINING) {
+				/* the buffer only has room for one rune per cell */
+				cluster = tgetcluster(gp, &len);
+				i = ptr - str;
+				bufsize += (len - 1) * UTF_SIZ;
+				str = xrealloc(str, bufsize);
+				ptr = str + i;
+				for (i = 0; i < len; i++)
+					ptr += utf8encode(cluster[i], ptr);
+				continue;
+			}
+
 			ptr += utf8encode(gp->u, ptr);
 		}
 
@@ -872,6 +959,7 @@ ttyread(void)
 			return ret;
 		}
 		already_processing = 1;
+		tpredictdirty();
 		while (1) {
 			int buflen_before_processing = buflen;
 			written += twrite(buf + written, buflen - written, 0);
@@ -884,6 +972,7 @@ ttyread(void)
 			if (buflen_before_processing == buflen)
 				break;
 		}
+		tpredictsettle();
 		already_processing = 0;
 		buflen -= written;
 		/* keep any incomplete UTF-8 byte sequence for the next call */
@@ -897,9 +986,18 @@ void
 ttywrite(const char *s, size_t n, int may_echo)
 {
 	const char *next;
+	Arg a;
+
+	/* typing brings a view pinned by scrollpin back to the screen */
+	if (may_echo && TSCREEN.off) {
+		a.i = TSCREEN.off;
+		kscrolldown(&a);
+	}
 
 	if (may_echo && IS_SET(MODE_ECHO))
 		twrite(s, n, 1);
+	if (may_echo)
+		tpredict(s, n);
 
 	if (!IS_SET(MODE_CRLF)) {
 		ttywriteraw(s, n);
@@ -1058,9 +1156,57 @@ tsetdirtattr(int attr)
 void
 tfulldirt(void)
 {
+	term.viewshift = 0;
+	memset(term.drawn, 0, term.row * sizeof(*term.drawn));
 	tsetdirt(0, term.row-1);
 }
 
+/*
+ * The view moved n rows down through the history. The rows still on the
+ * screen are moved by xscrollview() when drawing, only the uncovered ones are
+ * drawn again.
+ */
+void
+tscrollview(int n)
+{
+	if (n == 0)
+		return;
+	if (abs(n) >= term.row || abs(term.viewshift + n) >= term.row) {
+		tfulldirt();
+		return;
+	}
+
+	term.viewshift += n;
+	if (n > 0) {
+		memmove(&term.dirty[n], term.dirty,
+				(term.row - n) * sizeof(*term.dirty));
+		tsetdirt(0, n - 1);
+	} else {
+		memmove(term.dirty, &term.dirty[-n],
+				(term.row + n) * sizeof(*term.dirty));
+		tsetdirt(term.row + n, term.row - 1);
+	}
+}
+
+/* Moves the shadow rows as xscrollview() moves the pixels. */
+void
+tscrollshadow(int n)
+{
+	if (n > 0) {
+		memmove(&term.shadow[n * term.col], term.shadow,
+				(term.row - n) * term.col * sizeof(*term.shadow));
+		memmove(&term.drawn[n], term.drawn,
+				(term.row - n) * sizeof(*term.drawn));
+		memset(term.drawn, 0, n * sizeof(*term.drawn));
+	} else {
+		memmove(term.shadow, &term.shadow[-n * term.col],
+				(term.row + n) * term.col * sizeof(*term.shadow));
+		memmove(term.drawn, &term.drawn[-n],
+				(term.row + n) * sizeof(*term.drawn));
+		memset(&term.drawn[term.row + n], 0, -n * sizeof(*term.drawn));
+	}
+}
+
 void
 tcursor(int mode)
 {
@@ -1083,6 +1229,8 @@ treset(void)
 		term.tabs[i] = 1;
 	term.top = 0;
 	term.bot = term.row - 1;
+	term.left = 0;
+	term.right = term.col - 1;
 	term.mode = MODE_WRAP|MODE_UTF8;
 	memset(term.trantbl, CS_USA, sizeof(term.trantbl));
 	term.charset = 0;
@@ -1094,6 +1242,7 @@ treset(void)
 			.decor = DECOR_DEFAULT_COLOR
 		}};
 		term.screen[i].cur = 0;
+		term.screen[i].base = 0;
 		term.screen[i].off = 0;
 		for (j = 0; j < term.row; ++j) {
 			if (term.col != term.linelen)
@@ -1107,6 +1256,8 @@ treset(void)
 	}
 	tcursor(CURSOR_LOAD);
 	term.linelen = term.col;
+	term.primarycy = -1;
+	nmarks = 0;
 	tfulldirt();
 }
 
@@ -1126,10 +1277,70 @@ tnew(int col, int row)
 	treset();
 }
 
+/*
+ * Gives back what bursts of output left allocated, returns the bytes freed.
+ * Columns kept from a wider window are only dropped when narrow is set.
+ */
+size_t
+tcompact(int narrow)
+{
+	size_t freed = 0;
+	int i;
+
+	if (!(term.esc & (ESC_STR|ESC_STR_END)) && strescseq.siz > STR_BUF_SIZ) {
+		freed += strescseq.siz - STR_BUF_SIZ;
+		strreset();
+	}
+
+	if (narrow && term.linelen > term.col) {
+		for (i = 0; i < term.screen[0].size; ++i) {
+			if (!term.screen[0].buffer[i])
+				continue;
+			term.screen[0].buffer[i] = xrealloc(term.screen[0].buffer[i],
+					term.col * sizeof(Glyph));
+			freed += (term.linelen - term.col) * sizeof(Glyph);
+		}
+		for (i = 0; i < term.screen[1].size; ++i) {
+			term.screen[1].buffer[i] = xrealloc(term.screen[1].buffer[i],
+					term.col * sizeof(Glyph));
+			freed += (term.linelen - term.col) * sizeof(Glyph);
+		}
+		term.linelen = term.col;
+	}
+	freed += clustercompact();
+
+	return freed;
+}
+
 void
 tswapscreen(void)
 {
+	int i;
+
+	/*
+	 * The primary screen as drawn is kept while the alternate one is in
+	 * use, and put back in one copy if it is still valid.
+	 */
+	if (!IS_SET(MODE_ALTSCREEN)) {
+		for (i = 0; i < term.row && !term.dirty[i]; i++)
+			;
+		term.primarycy = -1;
+		if (i == term.row && !term.viewshift && !TSCREEN.off &&
+		    sel.ob.x == -1 && xsaveprimary())
+			term.primarycy = term.ocy;
+	}
 	term.mode ^= MODE_ALTSCREEN;
+	if (!IS_SET(MODE_ALTSCREEN) && term.primarycy >= 0 &&
+	    sel.ob.x == -1 && xrestoreprimary()) {
+		/* the kept pixels still show the cursor */
+		memset(term.dirty, 0, term.row * sizeof(*term.dirty));
+		memset(term.drawn, 0, term.row * sizeof(*term.drawn));
+		tsetdirt(term.primarycy, term.primarycy);
+		term.primarycy = -1;
+		return;
+	}
+	if (!IS_SET(MODE_ALTSCREEN))
+		term.primarycy = -1;
 	tfulldirt();
 }
 
@@ -1145,8 +1356,11 @@ kscrollup(const Arg *a)
 	if (n > TSCREEN.size - term.row - TSCREEN.off) n = TSCREEN.size - term.row - TSCREEN.off;
 	while (!TLINE(-n)) --n;
 	TSCREEN.off += n;
+	tscrollview(n);
+	/* the moved highlight is redrawn if the selection is cleared */
+	if (sel.ob.x != -1)
+		tsetdirt(sel.nb.y + n, sel.ne.y + n);
 	selscroll(0, n);
-	tfulldirt();
 }
 
 void
@@ -1161,8 +1375,125 @@ kscrolldown(const Arg *a)
 	if (n < 0) n = (-n) * term.row;
 	if (n > TSCREEN.off) n = TSCREEN.off;
 	TSCREEN.off -= n;
+	tscrollview(-n);
+	if (sel.ob.x != -1)
+		tsetdirt(sel.nb.y - n, sel.ne.y - n);
 	selscroll(0, -n);
-	tfulldirt();
+}
+
+/* index of the first mark on line or after it */
+int
+markfind(int64_t line)
+{
+	int lo = 0, hi = nmarks, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (marks[mid].line < line)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Records a shell integration mark at the cursor */
+void
+tmark(char type)
+{
+	LineBuffer *lb = &term.screen[0];
+	int64_t line = lb->base + term.c.y;
+	int i;
+
+	if (IS_SET(MODE_ALTSCREEN) || !type || !strchr("ABCD", type))
+		return;
+
+	/* the lines after the cursor were written again */
+	nmarks = markfind(line + 1);
+	/* and the oldest ones fell off the history */
+	if ((i = markfind(lb->base + term.row - lb->size)) > 0) {
+		nmarks -= i;
+		memmove(marks, &marks[i], nmarks * sizeof(*marks));
+	}
+
+	if (nmarks == markscap) {
+		markscap = MAX(2 * markscap, 64);
+		marks = xrealloc(marks, markscap * sizeof(*marks));
+	}
+	marks[nmarks++] = (Mark){ line, term.c.x, type };
+}
+
+/* Scrolls the view to the previous (arg->i < 0) or next prompt */
+void
+kscrolltoprompt(const Arg *arg)
+{
+	LineBuffer *lb = &term.screen[0];
+	int64_t top = lb->base - lb->off;
+	int i;
+	Arg a;
+
+	if (IS_SET(MODE_ALTSCREEN))
+		return;
+
+	if (arg->i < 0) {
+		for (i = markfind(top); --i >= 0 && marks[i].type != 'A';)
+			;
+		if (i < 0)
+			return;
+		a.i = top - marks[i].line;
+		kscrollup(&a);
+	} else {
+		for (i = markfind(top + 1); i < nmarks && marks[i].type != 'A'; i++)
+			;
+		a.i = (i < nmarks) ? marks[i].line - top : lb->off;
+		if (a.i > 0)
+			kscrolldown(&a);
+	}
+}
+
+/* Selects the output of the last command, scrolling to its start */
+void
+selectoutput(const Arg *arg)
+{
+	LineBuffer *lb = &term.screen[0];
+	int64_t start, end, top;
+	int i;
+	Arg a;
+
+	if (IS_SET(MODE_ALTSCREEN))
+		return;
+
+	for (i = markfind(lb->base + term.c.y + 1); --i >= 0 && marks[i].type != 'C';)
+		;
+	if (i < 0)
+		return;
+	start = marks[i].line;
+	for (i++; i < nmarks && marks[i].type != 'D' && marks[i].type != 'A'; i++)
+		;
+	if (i < nmarks)
+		end = marks[i].line - (marks[i].col == 0);
+	else
+		end = lb->base + term.c.y - (term.c.x == 0);
+	if (end < start)
+		return;
+
+	top = lb->base - lb->off;
+	if (start < top || start >= top + term.row) {
+		a.i = top - start;
+		if (a.i > 0) {
+			kscrollup(&a);
+		} else {
+			a.i = -a.i;
+			kscrolldown(&a);
+		}
+		top = lb->base - lb->off;
+		if (start < top)
+			return; /* not in the history anymore */
+	}
+
+	selstart(0, start - top, SNAP_LINE);
+	selextend(term.col - 1, MIN(end - top, term.row - 1), SEL_REGULAR, 1);
+	xsetsel(getsel());
 }
 
 void
@@ -1172,6 +1503,10 @@ tscrolldown(int orig, int n)
 	Line temp;
 
 	LIMIT(n, 0, term.bot-orig+1);
+	if (term.left > 0 || term.right < term.col-1) {
+		tscrollrect(orig, -n);
+		return;
+	}
 
 	/* Ensure that lines are allocated */
 	for (i = -n; i < 0; i++) {
@@ -1192,6 +1527,7 @@ tscrolldown(int orig, int n)
 
 	/* Scroll buffer */
 	TSCREEN.cur = (TSCREEN.cur + TSCREEN.size - n) % TSCREEN.size;
+	TSCREEN.base -= n;
 	/* Clear lines that have entered the view */
 	tclearregion(0, orig, term.linelen-1, orig+n-1);
 	/* Redraw portion of the screen that has scrolled */
@@ -1206,6 +1542,10 @@ tscrollup(int orig, int n)
 	Line temp;
 
 	LIMIT(n, 0, term.bot-orig+1);
+	if (term.left > 0 || term.right < term.col-1) {
+		tscrollrect(orig, n);
+		return;
+	}
 
 	/* Ensure that lines are allocated */
 	for (i = term.row; i < term.row + n; i++) {
@@ -1226,6 +1566,7 @@ tscrollup(int orig, int n)
 
 	/* Scroll buffer */
 	TSCREEN.cur = (TSCREEN.cur + n) % TSCREEN.size;
+	TSCREEN.base += n;
 	/* Clear lines that have entered the view */
 	tclearregion(0, term.bot-n+1, term.linelen-1, term.bot);
 	/* Redraw portion of the screen that has scrolled */
@@ -1233,6 +1574,46 @@ tscrollup(int orig, int n)
 	selscroll(orig, -n);
 }
 
+/*
+ * Scrolls the rows orig to term.bot between the left and right margins, n
+ * rows up, or down if n is negative. The cells are copied, as the lines are
+ * only partly in the region, and nothing goes to the history.
+ */
+void
+tscrollrect(int orig, int n)
+{
+	int y, w = term.right - term.left + 1;
+
+	for (y = orig; y <= term.bot; y++) {
+		tbreakwide(term.left, y);
+		tbreakwide(term.right+1, y);
+	}
+	if (n > 0) {
+		for (y = orig; y <= term.bot-n; y++) {
+			memcpy(&TLINE(y)[term.left], &TLINE(y+n)[term.left],
+					w * sizeof(Glyph));
+		}
+		tclearregion(term.left, term.bot-n+1, term.right, term.bot);
+	} else if (n < 0) {
+		for (y = term.bot; y >= orig-n; y--) {
+			memcpy(&TLINE(y)[term.left], &TLINE(y+n)[term.left],
+					w * sizeof(Glyph));
+		}
+		tclearregion(term.left, orig, term.right, orig-n-1);
+	}
+	tsetdirt(orig, term.bot);
+	if (sel.ob.x != -1 && sel.nb.y <= term.bot && sel.ne.y >= orig)
+		selclear();
+}
+
+/* Blanks a wide character that a margin before column x cuts in two. */
+void
+tbreakwide(int x, int y)
+{
+	if (x > 0 && x < term.col && (TLINE(y)[x].mode & ATTR_WDUMMY))
+		tclearregion(x-1, y, x, y);
+}
+
 void
 selscroll(int orig, int n)
 {
@@ -1256,14 +1637,17 @@ selscroll(int orig, int n)
 void
 tnewline(int first_col)
 {
-	int y = term.c.y;
+	int x = term.c.x, y = term.c.y;
 
 	if (y == term.bot) {
-		tscrollup(term.top, 1);
+		if (BETWEEN(x, term.left, term.right))
+			tscrollup(term.top, 1);
 	} else {
 		y++;
 	}
-	tmoveto(first_col ? 0 : term.c.x, y);
+	if (first_col)
+		x = (x >= term.left) ? term.left : 0;
+	tmoveto(x, y);
 }
 
 void
@@ -1300,23 +1684,30 @@ csiparse(void)
 void
 tmoveato(int x, int y)
 {
-	tmoveto(x, y + ((term.c.state & CURSOR_ORIGIN) ? term.top: 0));
+	if (term.c.state & CURSOR_ORIGIN)
+		tmoveto(x + term.left, y + term.top);
+	else
+		tmoveto(x, y);
 }
 
 void
 tmoveto(int x, int y)
 {
-	int miny, maxy;
+	int minx, maxx, miny, maxy;
 
 	if (term.c.state & CURSOR_ORIGIN) {
+		minx = term.left;
+		maxx = term.right;
 		miny = term.top;
 		maxy = term.bot;
 	} else {
+		minx = 0;
+		maxx = term.col - 1;
 		miny = 0;
 		maxy = term.row - 1;
 	}
 	term.c.state &= ~CURSOR_WRAPNEXT;
-	term.c.x = LIMIT(x, 0, term.col-1);
+	term.c.x = LIMIT(x, minx, maxx);
 	term.c.y = LIMIT(y, miny, maxy);
 }
 
@@ -1374,6 +1765,134 @@ tsetchar(Rune u, const Glyph *attr, int x, int y)
 	}
 }
 
+khint32_t
+clusterhash(uint32_t off)
+{
+	khint32_t h = 0;
+	Rune i;
+
+	for (i = 0; i <= clusterpool[off]; i++)
+		h = h * 31 + clusterpool[off + i];
+	return h;
+}
+
+int
+clustereq(uint32_t a, uint32_t b)
+{
+	return !memcmp(&clusterpool[a], &clusterpool[b],
+	               (clusterpool[a] + 1) * sizeof(Rune));
+}
+
+Rune
+clusterintern(const Rune *r, int len)
+{
+	khiter_t k;
+	uint32_t off;
+	int ret;
+
+	if (!clusterset)
+		clusterset = kh_init(clusters);
+	if (clusterpoollen + len + 1 > clusterpoolcap) {
+		clusterpoolcap = MAX(2 * clusterpoolcap, 256);
+		clusterpool = xrealloc(clusterpool,
+		                       clusterpoolcap * sizeof(Rune));
+	}
+
+	/* the candidate is written past the end of the pool for lookup */
+	off = clusterpoollen;
+	clusterpool[off] = len;
+	memcpy(&clusterpool[off + 1], r, len * sizeof(Rune));
+	k = kh_put(clusters, clusterset, off, &ret);
+	if (ret == 0)
+		return CLUSTER_BASE + kh_key(clusterset, k);
+	clusterpoollen += len + 1;
+
+	return CLUSTER_BASE + off;
+}
+
+/*
+ * Builds the pool again from the clusters still in the cells of both screens
+ * and the history, returns the bytes freed.
+ */
+size_t
+clustercompact(void)
+{
+	Rune *pool = clusterpool;
+	size_t cap = clusterpoolcap;
+	LineBuffer *lb;
+	Line line;
+	uint32_t off;
+	int i, x;
+
+	if (!clusterpoollen)
+		return 0;
+	kh_destroy(clusters, clusterset);
+	clusterset = NULL;
+	clusterpool = NULL;
+	clusterpoollen = clusterpoolcap = 0;
+
+	for (lb = term.screen; lb < &term.screen[2]; lb++) {
+		for (i = 0; i < lb->size; i++) {
+			if (!(line = lb->buffer[i]))
+				continue;
+			for (x = 0; x < term.linelen; x++) {
+				if (!(line[x].mode & ATTR_COMBINING))
+					continue;
+				off = line[x].u - CLUSTER_BASE;
+				line[x].u = clusterintern(&pool[off + 1],
+				                          pool[off]);
+			}
+		}
+	}
+	free(pool);
+	/* the offsets changed under the cells as drawn */
+	memset(term.drawn, 0, term.row * sizeof(*term.drawn));
+
+	return (cap - clusterpoolcap) * sizeof(Rune);
+}
+
+const Rune *
+tgetcluster(const Glyph *g, int *len)
+{
+	uint32_t off = g->u - CLUSTER_BASE;
+
+	*len = clusterpool[off];
+	return &clusterpool[off + 1];
+}
+
+Rune
+tbaserune(const Glyph *g)
+{
+	int len;
+
+	if (g->mode & ATTR_COMBINING)
+		return tgetcluster(g, &len)[0];
+	return g->u;
+}
+
+void
+tappendmark(Glyph *gp, Rune u)
+{
+	Rune cluster[CLUSTER_MAX];
+	const Rune *r;
+	int len;
+
+	if (gp->mode & ATTR_COMBINING) {
+		r = tgetcluster(gp, &len);
+		if (len >= CLUSTER_MAX)
+			return;
+		memcpy(cluster, r, len * sizeof(Rune));
+	} else {
+		cluster[0] = gp->u;
+		len = 1;
+	}
+	cluster[len++] = u;
+
+	gp->u = clusterintern(cluster, len);
+	/* box drawing needs the plain rune, let the font draw the cluster */
+	gp->mode = (gp->mode & ~ATTR_BOXDRAW) | ATTR_COMBINING;
+}
+
 void
 tclearregion(int x1, int y1, int x2, int y2)
 {
@@ -1507,15 +2026,17 @@ tdeletechar(int n)
 	int dst, src, size;
 	Glyph *line;
 
-	LIMIT(n, 0, term.col - term.c.x);
+	if (!BETWEEN(term.c.x, term.left, term.right))
+		return;
+	LIMIT(n, 0, term.right+1 - term.c.x);
 
 	dst = term.c.x;
 	src = term.c.x + n;
-	size = term.col - src;
+	size = term.right+1 - src;
 	line = TLINE(term.c.y);
 
 	memmove(&line[dst], &line[src], size * sizeof(Glyph));
-	tclearregion(term.col-n, term.c.y, term.col-1, term.c.y);
+	tclearregion(term.right+1-n, term.c.y, term.right, term.c.y);
 }
 
 void
@@ -1524,11 +2045,13 @@ tinsertblank(int n)
 	int dst, src, size;
 	Glyph *line;
 
-	LIMIT(n, 0, term.col - term.c.x);
+	if (!BETWEEN(term.c.x, term.left, term.right))
+		return;
+	LIMIT(n, 0, term.right+1 - term.c.x);
 
 	dst = term.c.x + n;
 	src = term.c.x;
-	size = term.col - dst;
+	size = term.right+1 - dst;
 	line = TLINE(term.c.y);
 
 	memmove(&line[dst], &line[src], size * sizeof(Glyph));
@@ -1538,14 +2061,16 @@ tinsertblank(int n)
 void
 tinsertblankline(int n)
 {
-	if (BETWEEN(term.c.y, term.top, term.bot))
+	if (BETWEEN(term.c.y, term.top, term.bot) &&
+	    BETWEEN(term.c.x, term.left, term.right))
 		tscrolldown(term.c.y, n);
 }
 
 void
 tdeleteline(int n)
 {
-	if (BETWEEN(term.c.y, term.top, term.bot))
+	if (BETWEEN(term.c.y, term.top, term.bot) &&
+	    BETWEEN(term.c.x, term.left, term.right))
 		tscrollup(term.c.y, n);
 }
 
@@ -1740,6 +2265,18 @@ tsetscroll(int t, int b)
 	term.bot = b;
 }
 
+/* DECSLRM, the margins must leave at least two columns */
+void
+tsetmargins(int l, int r)
+{
+	LIMIT(l, 0, term.col-1);
+	LIMIT(r, 0, term.col-1);
+	if (l >= r)
+		return;
+	term.left = l;
+	term.right = r;
+}
+
 void
 tsetmode(int priv, int set, const int *args, int narg)
 {
@@ -1761,6 +2298,10 @@ tsetmode(int priv, int set, const int *args, int narg)
 			case 7: /* DECAWM -- Auto wrap */
 				MODBIT(term.mode, set, MODE_WRAP);
 				break;
+			case 69: /* DECLRMM -- Left and right margin mode */
+				MODBIT(term.mode, set, MODE_LRMARGIN);
+				tsetmargins(0, term.col-1);
+				break;
 			case 0:  /* Error (IGNORED) */
 			case 2:  /* DECANM -- ANSI/VT52 (IGNORED) */
 			case 3:  /* DECCOLM -- Column  (IGNORED) */
@@ -1957,7 +2498,9 @@ csihandle(void)
 	case 'G': /* CHA -- Move to <col> */
 	case '`': /* HPA */
 		DEFAULT(csiescseq.arg[0], 1);
-		tmoveto(csiescseq.arg[0]-1, term.c.y);
+		tmoveto(csiescseq.arg[0]-1 +
+				((term.c.state & CURSOR_ORIGIN) ? term.left : 0),
+				term.c.y);
 		break;
 	case 'H': /* CUP -- Move to <row> <col> */
 	case 'f': /* HVP */
@@ -2038,7 +2581,8 @@ csihandle(void)
 		break;
 	case 'd': /* VPA -- Move to <row> */
 		DEFAULT(csiescseq.arg[0], 1);
-		tmoveato(term.c.x, csiescseq.arg[0]-1);
+		tmoveto(term.c.x, csiescseq.arg[0]-1 +
+				((term.c.state & CURSOR_ORIGIN) ? term.top : 0));
 		break;
 	case 'h': /* SM -- Set terminal mode */
 		tsetmode(csiescseq.priv, 1, csiescseq.arg, csiescseq.narg);
@@ -2063,7 +2607,15 @@ csihandle(void)
 			tmoveato(0, 0);
 		}
 		break;
-	case 's': /* DECSC -- Save cursor position (ANSI.SYS) */
+	case 's': /* DECSLRM -- Set left and right margins, if enabled */
+		if (IS_SET(MODE_LRMARGIN)) {
+			DEFAULT(csiescseq.arg[0], 1);
+			DEFAULT(csiescseq.arg[1], term.col);
+			tsetmargins(csiescseq.arg[0]-1, csiescseq.arg[1]-1);
+			tmoveato(0, 0);
+			break;
+		}
+		/* DECSC -- Save cursor position (ANSI.SYS) */
 		tcursor(CURSOR_SAVE);
 		break;
 	case 'u': /* DECRC -- Restore cursor position (ANSI.SYS) */
@@ -2202,6 +2754,10 @@ strhandle(void)
 			if (narg > 1)
 				xsettitle(strescseq.args[1]);
 			return;
+		case 133: /* shell integration */
+			if (narg > 1)
+				tmark(strescseq.args[1][0]);
+			return;
 		case 52:
 			if (narg > 2 && allowwindowops) {
 				dec = base64dec(strescseq.args[2]);
@@ -2260,6 +2816,8 @@ strhandle(void)
 		xsettitle(strescseq.args[0]);
 		return;
 	case '_': /* APC -- Application Program Command */
+		/* images shown on the kept primary screen may change */
+		term.primarycy = -1;
 		if (gr_parse_command(strescseq.buf, strescseq.len)) {
 			GraphicsCommandResult *res = &graphics_command_result;
 			if (res->create_placeholder) {
@@ -2396,12 +2954,21 @@ tdumpline(int n)
 {
 	char buf[UTF_SIZ];
 	const Glyph *bp, *end;
+	const Rune *cluster;
+	int i, len;
 
 	bp = &TLINE(n)[0];
 	end = &bp[MIN(tlinelen(n), term.col) - 1];
 	if (bp != end || bp->u != ' ') {
-		for ( ; bp <= end; ++bp)
-			tprinter(buf, utf8encode(bp->u, buf));
+		for ( ; bp <= end; ++bp) {
+			if (bp->mode & ATTR_COMBINING) {
+				cluster = tgetcluster(bp, &len);
+				for (i = 0; i < len; i++)
+					tprinter(buf, utf8encode(cluster[i], buf));
+			} else {
+				tprinter(buf, utf8encode(bp->u, buf));
+			}
+		}
 	}
 	tprinter("\n", 1);
 }
@@ -2415,6 +2982,137 @@ tdump(void)
 		tdumpline(i);
 }
 
+/*
+ * Writes the history and the screen to a file, or into the command following
+ * a '|'. The writing is done by a forked process: the fork is a snapshot of
+ * the lines for free, and st goes on meanwhile.
+ */
+void
+exporthistory(const Arg *arg)
+{
+	pid_t p;
+
+	/* the intermediate child is reaped here, the writer by init */
+	switch ((p = fork())) {
+	case -1:
+		fprintf(stderr, "fork failed: %s\n", strerror(errno));
+		return;
+	case 0:
+		switch (fork()) {
+		case -1:
+			fprintf(stderr, "fork failed: %s\n", strerror(errno));
+			break;
+		case 0:
+			texport(arg->v);
+			break;
+		}
+		_exit(0);
+	}
+	waitpid(p, NULL, 0);
+}
+
+void
+texport(const char *dest)
+{
+	LineBuffer *lb = &term.screen[0];
+	Glyph def = { .fg = defaultfg, .bg = defaultbg }, prev;
+	const Glyph *gp, *last;
+	const Rune *cluster;
+	char buf[UTF_SIZ];
+	FILE *f;
+	Line line;
+	long fd;
+	int i, j, len;
+
+	/* sigchld() only knows about the shell */
+	signal(SIGCHLD, SIG_DFL);
+	/*
+	 * the shell must not wait for the export to be hung up, nor the
+	 * window for it to be closed
+	 */
+	for (fd = sysconf(_SC_OPEN_MAX) - 1; fd > 2; fd--)
+		close(fd);
+	f = (dest[0] == '|') ? popen(dest + 1, "w") : fopen(dest, "w");
+	if (!f) {
+		fprintf(stderr, "exporthistory: %s: %s\n", dest, strerror(errno));
+		_exit(1);
+	}
+
+	/* from the oldest line of the ring buffer to the last on the screen */
+	for (i = term.row - lb->size; i < term.row; i++) {
+		if (!(line = lb->buffer[(lb->cur + i + lb->size) % lb->size]))
+			continue;
+		last = &line[MIN(term.col, term.linelen) - 1];
+		while (last > line && last->u == ' ' && !(last->mode & ATTR_WRAP)
+				&& last->bg == defaultbg)
+			--last;
+
+		prev = def;
+		for (gp = line; gp <= last; gp++) {
+			if (gp->mode & ATTR_WDUMMY)
+				continue;
+			if (exportattrs && ATTRCMP(prev, *gp)) {
+				texportsgr(f, gp);
+				prev = *gp;
+			}
+			if (gp->mode & ATTR_IMAGE) {
+				len = utf8encode(IMAGE_PLACEHOLDER_CHAR, buf);
+				fwrite(buf, 1, len, f);
+			} else if (gp->mode & ATTR_COMBINING) {
+				cluster = tgetcluster(gp, &len);
+				for (j = 0; j < len; j++)
+					fwrite(buf, 1, utf8encode(cluster[j], buf), f);
+			} else {
+				fwrite(buf, 1, utf8encode(gp->u, buf), f);
+			}
+		}
+		if (exportattrs && ATTRCMP(prev, def))
+			fputs("\033[0m", f);
+		if (!(last->mode & ATTR_WRAP))
+			fputc('\n', f);
+	}
+
+	if (((dest[0] == '|') ? pclose(f) : fclose(f)) != 0)
+		_exit(1);
+	_exit(0);
+}
+
+/* Writes the SGR sequence selecting the attributes and colors of g */
+void
+texportsgr(FILE *f, const Glyph *g)
+{
+	static const struct { ushort attr; int sgr; } attrs[] = {
+		{ ATTR_BOLD, 1 }, { ATTR_FAINT, 2 }, { ATTR_ITALIC, 3 },
+		{ ATTR_UNDERLINE, 4 }, { ATTR_BLINK, 5 }, { ATTR_REVERSE, 7 },
+		{ ATTR_INVISIBLE, 8 }, { ATTR_STRUCK, 9 },
+	};
+	uint32_t c[2] = { g->fg, g->bg };
+	int i, base;
+
+	fputs("\033[0", f);
+	for (i = 0; i < LEN(attrs); i++) {
+		if (g->mode & attrs[i].attr)
+			fprintf(f, ";%d", attrs[i].sgr);
+	}
+	for (i = 0; i < 2; i++) {
+		base = i ? 40 : 30;
+		if (c[i] == (i ? defaultbg : defaultfg))
+			continue;
+		if (IS_TRUECOL(c[i])) {
+			fprintf(f, ";%d;2;%u;%u;%u", base + 8,
+			        (c[i] >> 16) & 0xff, (c[i] >> 8) & 0xff,
+			        c[i] & 0xff);
+		} else if (c[i] < 8) {
+			fprintf(f, ";%u", base + c[i]);
+		} else if (c[i] < 16) {
+			fprintf(f, ";%u", base + 60 + c[i] - 8);
+		} else if (c[i] < 256) {
+			fprintf(f, ";%d;5;%u", base + 8, c[i]);
+		}
+	}
+	fputc('m', f);
+}
+
 void
 tputtab(int n)
 {
@@ -2501,7 +3199,7 @@ tcontrolcode(uchar ascii)
 		tmoveto(term.c.x-1, term.c.y);
 		return;
 	case '\r':   /* CR */
-		tmoveto(0, term.c.y);
+		tmoveto((term.c.x >= term.left) ? term.left : 0, term.c.y);
 		return;
 	case '\f':   /* LF */
 	case '\v':   /* VT */
@@ -2679,7 +3377,7 @@ tputc(Rune u)
 {
 	char c[UTF_SIZ];
 	int control;
-	int width, len;
+	int width, len, right;
 	Glyph *gp;
 
 	control = ISCONTROL(u);
@@ -2688,8 +3386,8 @@ tputc(Rune u)
 		width = len = 1;
 	} else {
 		len = utf8encode(u, c);
-		if (!control && (width = wcwidth(u)) == -1)
-			width = 1;
+		if (!control)
+			width = runewidth(u);
 	}
 
 	if (IS_SET(MODE_PRINT))
@@ -2781,17 +3479,19 @@ check_control_code:
 		selclear();
 
 	if (width == 0) {
-		// It's probably a combining char. Combining characters are not
-		// supported, so we just ignore them, unless it denotes the row and
-		// column of an image character.
-		if (term.c.y <= 0 && term.c.x <= 0)
+		// It's probably a combining char. It's attached to the previous
+		// cell, unless it denotes the row and column of an image
+		// character.
+		int y = term.c.y, x = term.c.x;
+		if (y <= 0 && x <= 0)
 			return;
-		else if (term.c.x == 0)
-			gp = &TLINE(term.c.y-1)[term.col-1];
-		else if (term.c.state & CURSOR_WRAPNEXT)
-			gp = &TLINE(term.c.y)[term.c.x];
-		else
-			gp = &TLINE(term.c.y)[term.c.x-1];
+		else if (x == 0)
+			y--, x = term.col-1;
+		else if (!(term.c.state & CURSOR_WRAPNEXT))
+			x--;
+		gp = &TLINE(y)[x];
+		if (x > 0 && (gp->mode & ATTR_WDUMMY))
+			gp--;
 		uint16_t num = diacritic_to_num(u);
 		if (num && (gp->mode & ATTR_IMAGE)) {
 			unsigned diaccount = tgetimgdiacriticcount(gp);
@@ -2802,6 +3502,9 @@ check_control_code:
 			else if (diaccount == 2)
 				tsetimg4thbyteplus1(gp, num);
 			tsetimgdiacriticcount(gp, diaccount + 1);
+		} else if (!(gp->mode & (ATTR_IMAGE|ATTR_WDUMMY))) {
+			tappendmark(gp, u);
+			term.dirty[y] = 1;
 		}
 		term.lastc = u;
 		return;
@@ -2814,12 +3517,15 @@ check_control_code:
 		gp = &TLINE(term.c.y)[term.c.x];
 	}
 
-	if (IS_SET(MODE_INSERT) && term.c.x+width < term.col)
-		memmove(gp+width, gp, (term.col - term.c.x - width) * sizeof(Glyph));
+	/* lines wrap at the right margin, unless the cursor is past it */
+	right = (term.c.x <= term.right) ? term.right+1 : term.col;
+	if (IS_SET(MODE_INSERT) && term.c.x+width < right)
+		memmove(gp+width, gp, (right - term.c.x - width) * sizeof(Glyph));
 
-	if (term.c.x+width > term.col) {
+	if (term.c.x+width > right) {
 		tnewline(1);
 		gp = &TLINE(term.c.y)[term.c.x];
+		right = term.right+1;
 	}
 
 	tsetchar(u, &term.c.attr, term.c.x, term.c.y);
@@ -2836,7 +3542,7 @@ check_control_code:
 			gp[1].mode = ATTR_WDUMMY;
 		}
 	}
-	if (term.c.x+width < term.col) {
+	if (term.c.x+width < right) {
 		tmoveto(term.c.x+width, term.c.y);
 	} else {
 		term.c.state |= CURSOR_WRAPNEXT;
@@ -2848,9 +3554,30 @@ twrite(const char *buf, int buflen, int show_ctrl)
 {
 	int charsize;
 	Rune u;
-	int n;
+	int n, pinned = 0;
+	int64_t top = 0;
+	Selection osel;
 
-	if (TSCREEN.off) {
+	/*
+	 * With scrollpin, the view scrolled back stays on the same lines. They
+	 * are all marked dirty, which only draws what the output changed in
+	 * them, and keeps tswapscreen() from taking the view as the screen.
+	 * The selection is moved to the rows of the screen while writing, so
+	 * that overwriting the selected cells clears it.
+	 */
+	if (TSCREEN.off && scrollpin) {
+		pinned = 1;
+		top = TSCREEN.base - TSCREEN.off;
+		osel = sel;
+		if (sel.ob.x != -1) {
+			sel.ob.y -= TSCREEN.off;
+			sel.oe.y -= TSCREEN.off;
+			sel.nb.y -= TSCREEN.off;
+			sel.ne.y -= TSCREEN.off;
+		}
+		TSCREEN.off = 0;
+		tsetdirt(0, term.row-1);
+	} else if (TSCREEN.off) {
 		TSCREEN.off = 0;
 		tfulldirt();
 	}
@@ -2877,9 +3604,219 @@ twrite(const char *buf, int buflen, int show_ctrl)
 		}
 		tputc(u);
 	}
+	if (pinned)
+		tpinview(top, &osel);
 	return n;
 }
 
+/*
+ * Scrolls the view back to the line top again after a write, unless the
+ * output went to the alternate screen. The selection is put back on the
+ * view unless the write cleared it, as when it overwrote the selected cells.
+ */
+void
+tpinview(int64_t top, const Selection *osel)
+{
+	int64_t off = TSCREEN.base - top;
+
+	if (IS_SET(MODE_ALTSCREEN))
+		return;
+	if (off > TSCREEN.size - term.row) {
+		/* the oldest lines were reused for the new ones */
+		TSCREEN.off = TSCREEN.size - term.row;
+		selclear();
+		return;
+	}
+	TSCREEN.off = off;
+	if (sel.ob.x != -1)
+		sel = *osel;
+}
+
+/* The line of the guesses, NULL if it left the history */
+Line
+tpredictline(void)
+{
+	int64_t y = predline - TSCREEN.base;
+
+	if (y >= term.row || y < term.row - TSCREEN.size)
+		return NULL;
+	return TSCREEN.buffer[(TSCREEN.cur + y + TSCREEN.size) % TSCREEN.size];
+}
+
+/* The row the guesses are shown on, -1 if they are not */
+int
+tpredictrow(void)
+{
+	int64_t y = predline - TSCREEN.base + TSCREEN.off;
+
+	if (!npreds || !predtrusted || predalt != IS_SET(MODE_ALTSCREEN) ||
+	    !BETWEEN(y, 0, term.row-1))
+		return -1;
+	return y;
+}
+
+void
+tpredictdirty(void)
+{
+	int y = tpredictrow();
+
+	if (y >= 0)
+		term.dirty[y] = 1;
+}
+
+/*
+ * The line to draw for row y: the guesses only ever go over a copy of it,
+ * so that the selection, the dumps and the echo never see them.
+ */
+Line
+tpredictover(Line line, int y)
+{
+	Prediction *p;
+
+	if (y != tpredictrow())
+		return line;
+	if (predoverlen < term.linelen) {
+		predoverlen = term.linelen;
+		predover = xrealloc(predover, predoverlen * sizeof(*predover));
+	}
+	memcpy(predover, line, term.col * sizeof(*predover));
+	for (p = preds; p < &preds[npreds]; p++) {
+		predover[p->x] = term.c.attr;
+		predover[p->x].u = p->u;
+		predover[p->x].mode |= ATTR_UNDERLINE;
+		predover[p->x].mode &= ~(ATTR_WIDE|ATTR_WRAP|ATTR_IMAGE|
+		                         ATTR_COMBINING);
+	}
+	return predover;
+}
+
+/*
+ * Guesses where the keys written to the tty will be echoed, at the cursor
+ * or after the previous guess, as long as they go to blank cells of the
+ * line. They are only drawn while the output keeps echoing them as is, so
+ * that a prompt that does not echo, as for a password, shows nothing. A
+ * control key may start a new prompt, which has to earn that trust again.
+ */
+void
+tpredict(const char *s, size_t n)
+{
+	Prediction *p;
+	Line line;
+	Rune u;
+	size_t len;
+	int x;
+
+	if (!predicttimeout || IS_SET(MODE_ECHO) || TSCREEN.off)
+		return;
+	if (npreds && predalt != IS_SET(MODE_ALTSCREEN))
+		predblocked = 1;
+	for (; n > 0; s += len, n -= len) {
+		if (!(len = utf8decode(s, &u, n)))
+			return;
+		if (ISCONTROL(u) || runewidth(u) != 1) {
+			tpredictdirty();
+			predtrusted = 0;
+			predblocked = 1;
+		}
+		if (predblocked || npreds == PREDICT_MAX)
+			return;
+
+		x = npreds ? preds[npreds-1].x + 1 : term.c.x;
+		line = TLINE(term.c.y);
+		if ((!npreds && (term.c.state & CURSOR_WRAPNEXT)) ||
+		    x >= term.col-1 || line[x].u != ' ' ||
+		    (line[x].mode & (ATTR_WDUMMY|ATTR_IMAGE))) {
+			predblocked = 1;
+			return;
+		}
+
+		p = &preds[npreds++];
+		*p = (Prediction){ .u = u, .x = x };
+		clock_gettime(CLOCK_MONOTONIC, &p->t);
+		predline = TSCREEN.base + term.c.y;
+		predalt = IS_SET(MODE_ALTSCREEN);
+		tpredictdirty();
+	}
+}
+
+/*
+ * Compares the guesses with the output. The echoed ones are dropped and
+ * the others kept if the cursor stands right before them. The guesses are
+ * trusted only if the output echoed one and left the cursor after it; any
+ * other output, a new prompt included, takes back the trust.
+ */
+void
+tpredictsettle(void)
+{
+	Prediction *p;
+	Line line;
+	int64_t cline = TSCREEN.base + term.c.y;
+	size_t left;
+	int i, keep;
+
+	predblocked = 0;
+	predtrusted = 0;
+	if (!npreds)
+		return;
+	if (predalt != IS_SET(MODE_ALTSCREEN)) {
+		npreds = 0;
+		return;
+	}
+	line = tpredictline();
+	for (i = 0; i < npreds; i++) {
+		p = &preds[i];
+		if (cline < predline || (cline == predline && term.c.x <= p->x))
+			break;
+		if (line && (line[p->x].u != p->u ||
+		    (line[p->x].mode & (ATTR_WDUMMY|ATTR_COMBINING)))) {
+			npreds = 0;
+			return;
+		}
+	}
+	keep = cline == predline &&
+	       term.c.x == (i ? preds[i-1].x + 1 : preds[0].x);
+	if (!keep) {
+		npreds = 0;
+		return;
+	}
+	predtrusted = i > 0;
+	left = npreds - i;
+	memmove(preds, &preds[i], left * sizeof(*preds));
+	npreds = left;
+	tpredictdirty();
+}
+
+/*
+ * Takes back the guesses not echoed within predicttimeout. Returns the ms
+ * until the oldest one expires, -1 if there are none.
+ */
+int
+tpredictexpire(void)
+{
+	struct timespec now;
+	int left;
+
+	if (!npreds)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left = predicttimeout - TIMEDIFF(now, preds[0].t);
+	if (left > 0)
+		return left;
+	tpredictdirty();
+	npreds = 0;
+	predtrusted = 0;
+	return -1;
+}
+
+/* Column of the cursor as shown, after the guesses */
+int
+tpredictcursor(void)
+{
+	if (tpredictrow() >= 0 && predline == TSCREEN.base + term.c.y)
+		return preds[npreds-1].x + 1;
+	return term.c.x;
+}
+
 void
 clearline(Line line, Glyph g, int x, int xend)
 {
@@ -2915,9 +3852,13 @@ tresize(int col, int row)
 		return;
 	}
 
+	/* the guesses of the local echo would not be where they were */
+	npreds = 0;
+
 	/* Shift buffer to keep the cursor where we expect it */
 	if (row <= term.c.y) {
 		term.screen[0].cur = (term.screen[0].cur - row + term.c.y + 1) % term.screen[0].size;
+		term.screen[0].base += term.c.y + 1 - row;
 	}
 
 	/* Resize and clear line buffers as needed */
@@ -2957,6 +3898,8 @@ tresize(int col, int row)
 
 	/* resize to new height */
 	term.dirty = xrealloc(term.dirty, row * sizeof(*term.dirty));
+	term.drawn = xrealloc(term.drawn, row * sizeof(*term.drawn));
+	term.shadow = xrealloc(term.shadow, row * col * sizeof(*term.shadow));
 	term.tabs = xrealloc(term.tabs, col * sizeof(*term.tabs));
 
 	/* fix tabstops */
@@ -2976,6 +3919,7 @@ tresize(int col, int row)
 	term.linelen = linelen;
 	/* reset scrolling region */
 	tsetscroll(0, row-1);
+	tsetmargins(0, col-1);
 	/* make use of the LIMIT in tmoveto */
 	tmoveto(term.c.x, term.c.y);
 	tfulldirt();
@@ -2998,21 +3942,120 @@ drawregion(int x1, int y1, int x2, int y2)
 	for (y = y1; y < y2; y++) {
 		if (term.dirty[y]) {
 			term.dirty[y] = 0;
-			xdrawline(TSCREEN.buffer[L], x1, y, x2);
+			drawdiff(tpredictover(TSCREEN.buffer[L], y),
+			         y, x1, x2);
 		}
 		L = (L + 1) % TSCREEN.size;
 	}
+	xflushlines();
 
 	xfinishimagedraw();
 }
 
+/*
+ * Queues the cells of a dirty row that differ from what was drawn last, so
+ * that repainting a row with the same content draws nothing. Blinking cells
+ * and images are always drawn.
+ */
+void
+drawdiff(Line line, int y, int x1, int x2)
+{
+	Glyph *shadow = &term.shadow[y * term.col], g;
+	int x, xa = -1, xb = 0, done = 0;
+
+	for (x = x1; x < x2; x++) {
+		g = line[x];
+		if (selected(x, y))
+			g.mode ^= ATTR_REVERSE;
+		if (term.drawn[y] && !(g.mode & (ATTR_BLINK|ATTR_IMAGE)) &&
+		    g.u == shadow[x].u && !ATTRCMP(g, shadow[x]))
+			continue;
+		shadow[x] = g;
+		/* spans that would touch once widened are drawn as one */
+		if (xa >= 0 && x - xb > 2) {
+			done = drawspan(line, y, xa, xb);
+			xa = -1;
+		}
+		if (x < done)
+			continue;
+		if (xa < 0)
+			xa = x;
+		xb = x + 1;
+	}
+	if (xa >= 0)
+		drawspan(line, y, xa, xb);
+	term.drawn[y] = 1;
+}
+
+/*
+ * Queues a span widened by a cell on both sides, for overhanging glyphs, or
+ * to the runs shaped together. Returns the end of the span queued.
+ */
+int
+drawspan(Line line, int y, int x1, int x2)
+{
+	x1 = MAX(x1 - 1, 0);
+	x2 = MIN(x2 + 1, term.col);
+#ifdef HARFBUZZ
+	/* a changed cell can change the ligature around it */
+	x1 = shaperun(line, x1, -1);
+	x2 = shaperun(line, x2 - 1, 1) + 1;
+	if (x2 < term.col && line[x2].mode & ATTR_WDUMMY)
+		x2++;
+#endif
+	if (x1 > 0 && line[x1].mode & ATTR_WDUMMY)
+		x1--;
+	xdrawline(line, x1, y, x2);
+	return x2;
+}
+
+#ifdef HARFBUZZ
+/*
+ * The last cell in direction dir of the run of x that xshapespecs() may
+ * shape as one: plain cells in the same font, whatever their fallback.
+ */
+int
+shaperun(Line line, int x, int dir)
+{
+	const ushort unshaped = ATTR_COMBINING|ATTR_BOXDRAW|ATTR_IMAGE;
+	const ushort font = ATTR_BOLD|ATTR_ITALIC;
+	ushort mode;
+	int i;
+
+	if (x > 0 && line[x].mode & ATTR_WDUMMY)
+		x--;
+	if ((mode = line[x].mode) & unshaped)
+		return x;
+	for (i = x + dir; BETWEEN(i, 0, term.col-1); i += dir) {
+		if (line[i].mode & ATTR_WDUMMY)
+			continue;
+		if (line[i].mode & unshaped || (line[i].mode ^ mode) & font)
+			break;
+		x = i;
+	}
+	return x;
+}
+#endif
+
 void
 draw(void)
 {
-	int cx = term.c.x, ocx = term.ocx, ocy = term.ocy;
+	int cx = tpredictcursor(), ocx = term.ocx, ocy = term.ocy, oy;
+	Glyph g, og;
 
 	if (!xstartdraw())
 		return;
+	if (term.viewshift) {
+		xscrollview(term.viewshift);
+		tscrollshadow(term.viewshift);
+		/* the soft renderer moved the old cursor along with the rows */
+		oy = term.ocy + term.viewshift;
+		if (BETWEEN(oy, 0, term.row-1)) {
+			term.drawn[oy] = 0;
+			term.dirty[oy] = 1;
+		}
+		term.viewshift = 0;
+	}
 
 	/* adjust cursor position */
 	LIMIT(term.ocx, 0, term.col-1);
@@ -3023,9 +4066,12 @@ draw(void)
 		cx--;
 
 	drawregion(0, 0, term.col, term.row);
-	if (TSCREEN.off == 0)
-		xdrawcursor(cx, term.c.y, TLINE(term.c.y)[cx],
-				term.ocx, term.ocy, TLINE(term.ocy)[term.ocx]);
+	if (TSCREEN.off == 0) {
+		/* the guesses of the local echo are only in what is drawn */
+		g = tpredictover(TLINE(term.c.y), term.c.y)[cx];
+		og = tpredictover(TLINE(term.ocy), term.ocy)[term.ocx];
+		xdrawcursor(cx, term.c.y, g, term.ocx, term.ocy, og);
+	}
 	term.ocx = cx;
 	term.ocy = term.c.y;
 	xfinishdraw();
@@ -20,6 +20,7 @@
 #define TRUECOLOR(r,g,b)	(1 << 24 | (r) << 16 | (g) << 8 | (b))
 #define IS_TRUECOL(x)		(1 << 24 & (x))
 #define HISTSIZE            2000
+#define CLUSTER_MAX         8    /* max runes in a grapheme cluster */
 
 // This decor color indicates that the fg color should be used. Note that it's
 // not a 24-bit color because the 25-th bit is not set.
@@ -39,6 +40,7 @@ enum glyph_attribute {
 	ATTR_WIDE       = 1 << 9,
 	ATTR_WDUMMY     = 1 << 10,
 	ATTR_BOXDRAW    = 1 << 11,
+	ATTR_COMBINING  = 1 << 12, /* u is a grapheme cluster, see tgetcluster */
 	ATTR_BOLD_FAINT = ATTR_BOLD | ATTR_FAINT,
 	ATTR_IMAGE      = 1 << 14,
 };
@@ -104,13 +106,20 @@ void die(const char *, ...);
 void redraw(void);
 void draw(void);
 
+void exporthistory(const Arg *);
+void kscrollup(const Arg *);
+void kscrolldown(const Arg *);
+void kscrolltoprompt(const Arg *);
+void selectoutput(const Arg *);
 void printscreen(const Arg *);
 void printsel(const Arg *);
 void sendbreak(const Arg *);
 void toggleprinter(const Arg *);
 
 int tattrset(int);
+size_t tcompact(int);
 void tnew(int, int);
+int tpredictexpire(void);
 void tresize(int, int);
 void tsetdirtattr(int);
 void ttyhangup(void);
@@ -129,9 +138,17 @@ int selected(int, int);
 char *getsel(void);
 
 Glyph getglyphat(int, int);
+const Rune *tgetcluster(const Glyph *, int *);
 
 size_t utf8encode(Rune, char *);
 
+/* Unicode properties, defined in unicode.c (generated by gen_unicode.py) */
+int runewidth(Rune);
+int runeccc(Rune);
+/* Converts a diacritic to a row/column/etc number. The result is 1-base, 0
+ * means "couldn't convert". */
+uint16_t diacritic_to_num(uint32_t code);
+
 void *xmalloc(size_t);
 void *xrealloc(void *, size_t);
 char *xstrdup(const char *);
@@ -140,8 +157,9 @@ int isboxdraw(Rune);
 ushort boxdrawindex(const Glyph *);
 #ifdef XFT_VERSION
 /* only exposed to x.c, otherwise we'll need Xft.h for the types */
-void boxdraw_xinit(Display *, Colormap, XftDraw *, Visual *);
+void boxdraw_xinit(Display *, Colormap, Visual *);
 void drawboxes(int, int, int, int, XftColor *, XftColor *, const XftGlyphFontSpec *, int);
+void xdrawrect(XftColor *, int, int, int, int);
 #endif
 
 
@@ -149,10 +167,13 @@ void drawboxes(int, int, int, int, XftColor *, XftColor *, const XftGlyphFontSpe
 extern char *utmp;
 extern char *scroll;
 extern char *stty_args;
+extern int exportattrs;
 extern char *vtiden;
 extern wchar_t *worddelimiters;
 extern int allowaltscreen;
 extern int allowwindowops;
+extern int scrollpin;
+extern unsigned int predicttimeout;
 extern char *termname;
 extern unsigned int tabspaces;
 extern unsigned int defaultfg;
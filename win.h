@@ -27,6 +27,7 @@ void xbell(void);
 void xclipcopy(void);
 void xdrawcursor(int, int, Glyph, int, int, Glyph);
 void xdrawline(Line, int, int, int);
+void xflushlines(void);
 void xfinishdraw(void);
 void xloadcols(void);
 int xsetcolorname(int, const char *);
@@ -35,6 +36,9 @@ void xseticontitle(char *);
 void xsettitle(char *);
 int xsetcursor(int);
 void xsetmode(int, unsigned int);
+void xscrollview(int);
+int xsaveprimary(void);
+int xrestoreprimary(void);
 void xsetpointermotion(int);
 void xsetsel(char *);
 int xstartdraw(void);
@@ -1,15 +1,22 @@
 /* See LICENSE for license details. */
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <limits.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <sys/select.h>
 #include <time.h>
 #include <unistd.h>
 #include <libgen.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/cursorfont.h>
@@ -22,6 +29,10 @@ char *argv0;
 #include "st.h"
 #include "win.h"
 #include "graphics.h"
+#include "rast.h"
+#ifdef HARFBUZZ
+#include "hb.h"
+#endif
 
 /* types used in config.h */
 typedef struct {
@@ -68,12 +79,12 @@ static void togglegrdebug(const Arg *);
 static void dumpgrstate(const Arg *);
 static void unloadimages(const Arg *);
 static void toggleimages(const Arg *);
-void kscrollup(const Arg *);
-void kscrolldown(const Arg *);
 
 /* config.h for applying patches and the configuration. */
 #include "config.h"
 
+#include "rgb_data.h"
+
 /* XEMBED messages */
 #define XEMBED_FOCUS_IN  4
 #define XEMBED_FOCUS_OUT 5
@@ -88,6 +99,34 @@ typedef XftDraw *Draw;
 typedef XftColor Color;
 typedef XftGlyphFontSpec GlyphFontSpec;
 
+enum renderer {
+	RENDER_XFT,
+	RENDER_XRENDER,
+	RENDER_SOFT,
+};
+
+/* order in which the batched fills of a line are sent */
+enum fill_phase {
+	FILL_BG,
+	FILL_UNDER, /* underlines, drawn below the glyphs */
+	FILL_STRIP, /* glyph colors, filled into xw.strip */
+	FILL_OVER,  /* box drawing, strikethrough, cursor */
+	FILL_LAST,
+};
+
+typedef struct {
+	int phase;
+	XRenderColor color;
+	XRectangle *rects;
+	int n, cap;
+	int rowstart; /* first rectangle of the current row, see xbatchrow() */
+} FillBatch;
+
+typedef struct {
+	Line line;
+	int x1, y1, x2;
+} QueuedLine;
+
 /* Purely graphic info */
 typedef struct {
 	int tw, th; /* tty width and height */
@@ -119,6 +158,11 @@ typedef struct {
 	int isfixed; /* is fixed geometry? */
 	int l, t; /* left and top offset */
 	int gm; /* geometry mask */
+	int render; /* enum renderer */
+	Pixmap strip; /* one row of glyph colors, see xflushbatch() */
+	Picture strippict;
+	Pixmap cursorbuf; /* pixels under the cursor, see xsavecursor() */
+	Pixmap primarybuf; /* primary screen, see xsaveprimary() */
 } XWindow;
 
 typedef struct {
@@ -153,12 +197,29 @@ typedef struct {
 } DC;
 
 static inline ushort sixd_to_16bit(int);
+static int isinvisible(Rune);
+static int glyphspecs(const Glyph *);
 static int xmakeglyphfontspecs(XftGlyphFontSpec *, const Glyph *, int, int, int);
-static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, int, int, int);
+#ifdef HARFBUZZ
+static void xshapespecs(XftGlyphFontSpec *, const Glyph *, int);
+#endif
+static void xruncolors(Glyph *, Color *, Color *);
+static void xdrawbg(Color *, int, int, int);
+static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, int, int, int, int);
 static void xdrawglyph(Glyph, int, int);
 static void xdrawimages(Glyph, Line, int x1, int y1, int x2);
 static void xdrawoneimagecell(Glyph, int x, int y);
 static void xclear(int, int, int, int);
+static void xcreatestrip(void);
+static void xbatchrect(Color *, int, int, int, int);
+static void xbatchrow(void);
+static void xbatchglyphs(Color *, const XftGlyphFontSpec *, int, int, int, int);
+static void xflushbatch(void);
+static void xflushdraw(void);
+static void xcreatecursorbuf(void);
+static void xsavecursor(int, int, int);
+static void xfillline(Line, int, int, int);
+static void xdrawlineglyphs(Line, int, int, int);
 static int xgeommasktogravity(int);
 static int ximopen(Display *);
 static void ximinstantiate(Display *, XPointer, XPointer);
@@ -168,13 +229,27 @@ static void xinit(int, int);
 static void cresize(int, int);
 static void xresize(int, int);
 static void xhints(void);
+static int cmprgbname(const void *, const void *);
+static int xparsecolor(const char *, XRenderColor *);
 static int xloadcolor(int, const char *, Color *);
 static int xloadfont(Font *, FcPattern *);
 static void xloadfonts(const char *, double);
 static void xunloadfont(Font *);
-static void xunloadfonts(void);
+static void xswapfonts(double);
+static void xcompact(int);
+static void xscrollstep(void);
+static long residentkib(void);
+static void sigcompact(int);
+#ifdef DRAWSTATS
+static void sigdrawstats(int);
+static double sincestart(void);
+static int cmpdouble(const void *, const void *);
+static void drawstats(void);
+#endif
 static void xsetenv(void);
 static void xseturgency(int);
+static void xsettextprop(char *, Atom, int);
+static void flushprops(void);
 static int evcol(XEvent *);
 static int evrow(XEvent *);
 
@@ -190,6 +265,7 @@ static int mouseaction(XEvent *, uint);
 static void brelease(XEvent *);
 static void bpress(XEvent *);
 static void bmotion(XEvent *);
+static void flushmotion(void);
 static void propnotify(XEvent *);
 static void selnotify(XEvent *);
 static void selclear_(XEvent *);
@@ -248,13 +324,73 @@ typedef struct {
 	XftFont *font;
 	int flags;
 	Rune unicodep;
+	int used; /* drawn since the last xcompact() */
 } Fontcache;
 
 /* Fontcache is an array now. A new font will be appended to the array. */
 static Fontcache *frc = NULL;
 static int frclen = 0;
 static int frccap = 0;
+
+/* The fonts of one size, kept by xswapfonts() */
+typedef struct {
+	double size;
+	Font font, bfont, ifont, ibfont;
+	Fontcache *frc;
+	int frclen, frccap;
+} FontSet;
+
+static FontSet *fontsets = NULL; /* most recently used first */
+static int nfontsets = 0;
+
+static void xunloadfontset(FontSet *);
 static char *usedfont = NULL;
+static int ttyfd;
+static char *usedrender = NULL;
+static volatile sig_atomic_t compactrequest = 0;
+
+#ifdef DRAWSTATS
+/* draw() times and X requests, reported on SIGTERM */
+static double *drawtimes = NULL;
+static int ndraws = 0, drawscap = 0;
+static unsigned long drawrequests = 0;
+static struct timespec starttime;
+static double spawnms, mapms, promptms = -1;
+static int outputseen = 0;
+static volatile sig_atomic_t statsrequest = 0;
+#endif
+
+/* xrender renderer: fills and glyphs of a line, sent by xflushbatch() */
+static FillBatch *batches = NULL;
+static int nbatches = 0;
+static int batchcap = 0;
+static int fillphase = FILL_BG;
+static XftGlyphFontSpec *textspecs = NULL;
+static int ntext = 0;
+static int textcap = 0;
+static int texty = 0;
+
+/* lines of the frame, drawn by xflushlines() */
+static QueuedLine *qlines = NULL;
+static int nqlines = 0;
+static int qlinescap = 0;
+static int fillinglines = 0; /* batching the backgrounds of queued lines */
+static int linebgs = 0; /* the backgrounds of the queued lines are drawn */
+static int linesdrawn = 0; /* lines were drawn since the last xfinishdraw() */
+
+/* cursor layer: what xfinishdraw() copies when only the cursor changed */
+static XRectangle cursorrect; /* area of xw.buf saved in xw.cursorbuf */
+static int cursorsaved = 0;
+static XRectangle cursorcells[2];
+static int ncursorcells = 0;
+
+/* smooth scrolling: the window shows xw.buf moved up by scrollpx pixels */
+static int scrollpx = 0;
+static int scrolltotal = 0;
+static int scrollnew = 0; /* the view moved in the current frame */
+static struct timespec scrollstart;
+
+static int primarysaved = 0; /* xw.primarybuf holds the primary screen */
 static double usedfontsize = 0;
 static double defaultfontsize = 0;
 
@@ -265,11 +401,26 @@ static char *opt_font  = NULL;
 static char *opt_io    = NULL;
 static char *opt_line  = NULL;
 static char *opt_name  = NULL;
+static char *opt_render = NULL;
 static char *opt_title = NULL;
 
 static uint buttons; /* bit field of pressed buttons */
 static int  cursorblinks = 0;
 
+/* Coalesced pointer motion, handled once per frame by flushmotion() */
+static XEvent pendingmotion;
+static int motionpending = 0;
+static int motioncol = -1, motionrow = -1;
+static uint motionstate;
+
+/*
+ * Window properties requested by the terminal. Only the latest value is
+ * sent to the X server, once per frame, by flushprops().
+ */
+static char *title, *icontitle;         /* last values set on the window */
+static char *pendingtitle, *pendingicontitle;
+static int urgent = 0, pendingurgent = -1;
+
 void
 clipcopy(const Arg *dummy)
 {
@@ -320,8 +471,7 @@ zoom(const Arg *arg)
 void
 zoomabs(const Arg *arg)
 {
-	xunloadfonts();
-	xloadfonts(usedfont, arg->f);
+	xswapfonts(arg->f);
 	cresize(0, 0);
 	redraw();
 	xhints();
@@ -403,6 +553,7 @@ void
 toggleimages(const Arg *arg)
 {
 	graphics_display_images = !graphics_display_images;
+	primarysaved = 0;
 	redraw();
 }
 
@@ -553,6 +704,10 @@ bpress(XEvent *e)
 	struct timespec now;
 	int snap;
 
+	/* keep the order of motion and button events */
+	flushmotion();
+	motioncol = motionrow = -1;
+
 	if (1 <= btn && btn <= 11)
 		buttons |= 1 << (btn-1);
 
@@ -781,6 +936,8 @@ brelease(XEvent *e)
 {
 	int btn = e->xbutton.button;
 
+	flushmotion();
+
 	if (1 <= btn && btn <= 11)
 		buttons &= ~(1 << (btn-1));
 
@@ -798,11 +955,40 @@ brelease(XEvent *e)
 void
 bmotion(XEvent *e)
 {
+	/*
+	 * Only the latest position matters, so motion is remembered here
+	 * and reported or applied to the selection by flushmotion() right
+	 * before the next frame or button event.
+	 */
+	pendingmotion = *e;
+	motionpending = 1;
+}
+
+void
+flushmotion(void)
+{
+	XEvent *e = &pendingmotion;
+	int col, row;
+
+	if (!motionpending)
+		return;
+	motionpending = 0;
+
 	if (IS_SET(MODE_MOUSE) && !(e->xbutton.state & forcemousemod)) {
 		mousereport(e);
 		return;
 	}
 
+	/* moves within the same cell don't change the selection */
+	col = evcol(e);
+	row = evrow(e);
+	if (col == motioncol && row == motionrow &&
+	    e->xbutton.state == motionstate)
+		return;
+	motioncol = col;
+	motionrow = row;
+	motionstate = e->xbutton.state;
+
 	mousesel(e, 0);
 }
 
@@ -839,10 +1025,21 @@ xresize(int col, int row)
 	xw.buf = XCreatePixmap(xw.dpy, xw.win, win.w, win.h,
 			DefaultDepth(xw.dpy, xw.scr));
 	XftDrawChange(xw.draw, xw.buf);
+	if (xw.render == RENDER_XRENDER)
+		xcreatestrip();
+	else if (xw.render == RENDER_SOFT)
+		rast_resize(xw.buf, win.w, win.h);
 	xclear(0, 0, win.w, win.h);
+	xflushdraw();
+	xcreatecursorbuf();
+	scrollpx = 0;
+	if (xw.primarybuf)
+		XFreePixmap(xw.dpy, xw.primarybuf);
+	xw.primarybuf = None;
+	primarysaved = 0;
 
 	/* resize to new width */
-	xw.specbuf = xrealloc(xw.specbuf, col * sizeof(GlyphFontSpec));
+	xw.specbuf = xrealloc(xw.specbuf, col * CLUSTER_MAX * sizeof(GlyphFontSpec));
 }
 
 ushort
@@ -851,6 +1048,66 @@ sixd_to_16bit(int x)
 	return x == 0 ? 0 : 0x3737 + 0x2828 * x;
 }
 
+int
+cmprgbname(const void *key, const void *elem)
+{
+	return strcmp(key, ((const RgbName *)elem)->name);
+}
+
+/*
+ * Parses #rgb, rgb:r/g/b with 1 to 4 hex digits per component, and the
+ * names of rgb.txt without a round trip to the server. Returns 0 for
+ * anything else, which is left to Xlib.
+ */
+int
+xparsecolor(const char *name, XRenderColor *color)
+{
+	const RgbName *c;
+	char key[32], *k, *end;
+	unsigned short v[3];
+	unsigned long n;
+	int i, len;
+
+	if (name[0] == '#') {
+		len = strlen(++name);
+		if (len % 3 || len < 3 || len > 12 ||
+		    strspn(name, "0123456789abcdefABCDEF") != len)
+			return 0;
+		len /= 3;
+		for (i = 0; i < 3; i++) {
+			memcpy(key, name + i * len, len);
+			key[len] = '\0';
+			v[i] = strtoul(key, NULL, 16) << (4 * (4 - len));
+		}
+	} else if (!strncasecmp(name, "rgb:", 4)) {
+		for (name += 4, i = 0; i < 3; i++, name = end + 1) {
+			n = strtoul(name, &end, 16);
+			len = end - name;
+			if (len < 1 || len > 4 || !isxdigit((uchar)*name) ||
+			    *end != (i < 2 ? '/' : '\0'))
+				return 0;
+			v[i] = n * 0xffff / ((1 << (4 * len)) - 1);
+		}
+	} else {
+		for (k = key; *name && k < key + sizeof(key) - 1; name++) {
+			if (*name != ' ')
+				*k++ = tolower((uchar)*name);
+		}
+		*k = '\0';
+		if (*name || !(c = bsearch(key, rgbnames, LEN(rgbnames),
+		    sizeof(*rgbnames), cmprgbname)))
+			return 0;
+		v[0] = c->r * 0x101;
+		v[1] = c->g * 0x101;
+		v[2] = c->b * 0x101;
+	}
+	color->red = v[0];
+	color->green = v[1];
+	color->blue = v[2];
+	color->alpha = 0xffff;
+	return 1;
+}
+
 int
 xloadcolor(int i, const char *name, Color *ncolor)
 {
@@ -872,6 +1129,10 @@ xloadcolor(int i, const char *name, Color *ncolor)
 			name = colorname[i];
 	}
 
+	/* on TrueColor visuals Xft computes the pixel from the masks */
+	if (xparsecolor(name, &color))
+		return XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &color,
+		                          ncolor);
 	return XftColorAllocName(xw.dpy, xw.vis, xw.cmap, name, ncolor);
 }
 
@@ -898,6 +1159,7 @@ xloadcols(void)
 				die("could not allocate color %d\n", i);
 		}
 	loaded = 1;
+	primarysaved = 0;
 }
 
 int
@@ -926,6 +1188,7 @@ xsetcolorname(int x, const char *name)
 
 	XftColorFree(xw.dpy, xw.vis, xw.cmap, &dc.col[x]);
 	dc.col[x] = ncolor;
+	primarysaved = 0;
 
 	return 0;
 }
@@ -936,11 +1199,210 @@ xsetcolorname(int x, const char *name)
 void
 xclear(int x1, int y1, int x2, int y2)
 {
-	XftDrawRect(xw.draw,
-			&dc.col[IS_SET(MODE_REVERSE)? defaultfg : defaultbg],
+	xdrawrect(&dc.col[IS_SET(MODE_REVERSE)? defaultfg : defaultbg],
 			x1, y1, x2-x1, y2-y1);
 }
 
+void
+xdrawrect(Color *color, int x, int y, int w, int h)
+{
+	if (xw.render == RENDER_SOFT)
+		rast_fill(color, x, y, w, h);
+	else if (xw.render == RENDER_XRENDER || fillinglines)
+		xbatchrect(color, x, y, w, h);
+	else
+		XftDrawRect(xw.draw, color, x, y, w, h);
+}
+
+void
+xcreatestrip(void)
+{
+	if (xw.strip) {
+		XRenderFreePicture(xw.dpy, xw.strippict);
+		XFreePixmap(xw.dpy, xw.strip);
+	}
+	xw.strip = XCreatePixmap(xw.dpy, xw.win, win.w, win.ch,
+			DefaultDepth(xw.dpy, xw.scr));
+	xw.strippict = XRenderCreatePicture(xw.dpy, xw.strip,
+			XRenderFindVisualFormat(xw.dpy, xw.vis), 0, NULL);
+}
+
+void
+xbatchrect(Color *color, int x, int y, int w, int h)
+{
+	FillBatch *b;
+	XRectangle *r;
+	int i;
+
+	if (w <= 0 || h <= 0)
+		return;
+
+	for (i = 0, b = batches; i < nbatches; i++, b++) {
+		if (b->phase == fillphase &&
+		    !memcmp(&b->color, &color->color, sizeof(b->color)))
+			break;
+	}
+	if (i == nbatches) {
+		if (nbatches == batchcap) {
+			batchcap += 16;
+			batches = xrealloc(batches, batchcap * sizeof(*batches));
+			memset(&batches[nbatches], 0, 16 * sizeof(*batches));
+		}
+		b = &batches[nbatches++];
+		b->phase = fillphase;
+		b->color = color->color;
+	}
+
+	/* extend the previous rectangle when it ends where this one starts */
+	if (b->n > 0) {
+		r = &b->rects[b->n - 1];
+		if (r->y == y && r->height == h && r->x + r->width == x) {
+			r->width += w;
+			return;
+		}
+	}
+	if (b->n == b->cap) {
+		b->cap = MAX(16, b->cap * 2);
+		b->rects = xrealloc(b->rects, b->cap * sizeof(*b->rects));
+	}
+	b->rects[b->n++] = (XRectangle){ x, y, w, h };
+}
+
+/* Merges the rectangles batched since the last call into those above them. */
+void
+xbatchrow(void)
+{
+	FillBatch *b;
+	XRectangle *r, *above, *end;
+	int i, j, k;
+
+	for (i = 0; i < nbatches; i++) {
+		b = &batches[i];
+		end = &b->rects[b->rowstart];
+		for (j = k = b->rowstart; j < b->n; j++) {
+			r = &b->rects[j];
+			for (above = b->rects; above < end; above++) {
+				if (above->x == r->x && above->width == r->width &&
+				    above->y + above->height == r->y)
+					break;
+			}
+			if (above < end)
+				above->height += r->height;
+			else
+				b->rects[k++] = *r;
+		}
+		b->n = b->rowstart = k;
+	}
+}
+
+/*
+ * Glyphs of different colors are sent in one request: they are masks over
+ * xw.strip, which holds the foreground color of each run of the row.
+ */
+void
+xbatchglyphs(Color *fg, const XftGlyphFontSpec *specs, int len, int winx,
+		int winy, int width)
+{
+	int phase = fillphase;
+
+	if (ntext > 0 && winy != texty)
+		xflushbatch();
+	texty = winy;
+
+	fillphase = FILL_STRIP;
+	xbatchrect(fg, winx, 0, width, win.ch);
+	fillphase = phase;
+
+	if (ntext + len > textcap) {
+		textcap = MAX(ntext + len, textcap * 2);
+		textspecs = xrealloc(textspecs, textcap * sizeof(*textspecs));
+	}
+	memcpy(&textspecs[ntext], specs, len * sizeof(*specs));
+	ntext += len;
+}
+
+void
+xflushbatch(void)
+{
+	Picture dst = XftDrawPicture(xw.draw);
+	FillBatch *b;
+	int phase, i;
+
+	for (phase = 0; phase < FILL_LAST; phase++) {
+		/*
+		 * The source is aligned with the first glyph; anything the
+		 * glyphs draw outside of the strip, i.e. the row, is clipped.
+		 */
+		if (phase == FILL_OVER && ntext > 0) {
+			XftGlyphFontSpecRender(xw.dpy, PictOpOver, xw.strippict,
+					dst, textspecs[0].x, textspecs[0].y - texty,
+					textspecs, ntext);
+			ntext = 0;
+		}
+		for (i = 0; i < nbatches; i++) {
+			b = &batches[i];
+			if (b->phase != phase || b->n == 0)
+				continue;
+			XRenderFillRectangles(xw.dpy,
+					b->color.alpha == 0xffff ? PictOpSrc : PictOpOver,
+					phase == FILL_STRIP ? xw.strippict : dst,
+					&b->color, b->rects, b->n);
+			b->n = b->rowstart = 0;
+		}
+	}
+
+	/* don't let truecolor output grow the color list forever */
+	if (nbatches > 64)
+		nbatches = 0;
+}
+
+void
+xcreatecursorbuf(void)
+{
+	if (xw.cursorbuf)
+		XFreePixmap(xw.dpy, xw.cursorbuf);
+	/* a wide cursor and the cells on both sides, for overhanging glyphs */
+	xw.cursorbuf = XCreatePixmap(xw.dpy, xw.win, 4 * win.cw, win.ch,
+			DefaultDepth(xw.dpy, xw.scr));
+	cursorsaved = 0;
+	ncursorcells = 0;
+}
+
+/*
+ * Saves the pixels of xw.buf the cursor at (cx, cy) will cover, so that
+ * xstartdraw() can take it off without redrawing the cell, and marks them
+ * for xfinishdraw(). The soft renderer redraws the cell instead, as its
+ * image would still hold the cursor.
+ */
+void
+xsavecursor(int cx, int cy, int wide)
+{
+	XRectangle *r = &cursorcells[ncursorcells++];
+	int x1 = win.hborderpx + (cx - 1) * win.cw,
+	    x2 = win.hborderpx + (cx + (wide ? 3 : 2)) * win.cw;
+
+	x1 = MAX(x1, 0);
+	x2 = MIN(x2, win.w);
+	*r = (XRectangle){ x1, win.vborderpx + cy * win.ch, x2 - x1, win.ch };
+	if (xw.render == RENDER_SOFT)
+		return;
+
+	XCopyArea(xw.dpy, xw.buf, xw.cursorbuf, dc.gc, r->x, r->y,
+			r->width, r->height, 0, 0);
+	cursorrect = *r;
+	cursorsaved = 1;
+}
+
+/* Sends what the renderer still holds to xw.buf. */
+void
+xflushdraw(void)
+{
+	if (xw.render == RENDER_XRENDER)
+		xflushbatch();
+	else if (xw.render == RENDER_SOFT)
+		rast_present();
+}
+
 void
 xhints(void)
 {
@@ -975,6 +1437,7 @@ xhints(void)
 	XSetWMProperties(xw.dpy, xw.win, NULL, NULL, NULL, 0, sizeh, &wm,
 			&class);
 	XFree(sizeh);
+	urgent = 0; /* the hints above replaced XUrgencyHint */
 }
 
 int
@@ -1146,16 +1609,127 @@ xunloadfont(Font *f)
 }
 
 void
-xunloadfonts(void)
+xunloadfontset(FontSet *fs)
 {
+	if (xw.render == RENDER_SOFT)
+		rast_dropglyphs();
+#ifdef HARFBUZZ
+	hbunloadfonts();
+#endif
+
 	/* Free the loaded fonts in the font cache.  */
-	while (frclen > 0)
-		XftFontClose(xw.dpy, frc[--frclen].font);
+	while (fs->frclen > 0)
+		XftFontClose(xw.dpy, fs->frc[--fs->frclen].font);
+	free(fs->frc);
+
+	xunloadfont(&fs->font);
+	xunloadfont(&fs->bfont);
+	xunloadfont(&fs->ifont);
+	xunloadfont(&fs->ibfont);
+}
+
+/*
+ * Switches to the fonts of another size. The fonts in use, with their
+ * fallbacks, are kept for the fontcachesize most recently used sizes, so
+ * that zooming back to them does not go through fontconfig again.
+ */
+void
+xswapfonts(double size)
+{
+	FontSet cur = { usedfontsize, dc.font, dc.bfont, dc.ifont, dc.ibfont,
+	                frc, frclen, frccap };
+	int i;
 
-	xunloadfont(&dc.font);
-	xunloadfont(&dc.bfont);
-	xunloadfont(&dc.ifont);
-	xunloadfont(&dc.ibfont);
+	if (size == usedfontsize)
+		return;
+	if (!fontsets)
+		fontsets = xmalloc((fontcachesize + 1) * sizeof(*fontsets));
+
+	for (i = 0; i < nfontsets && fontsets[i].size != size; i++)
+		;
+	if (i < nfontsets) {
+		usedfontsize = fontsets[i].size;
+		dc.font = fontsets[i].font;
+		dc.bfont = fontsets[i].bfont;
+		dc.ifont = fontsets[i].ifont;
+		dc.ibfont = fontsets[i].ibfont;
+		frc = fontsets[i].frc;
+		frclen = fontsets[i].frclen;
+		frccap = fontsets[i].frccap;
+		win.cw = ceilf(dc.font.width * cwscale);
+		win.ch = ceilf(dc.font.height * chscale);
+		memmove(&fontsets[1], &fontsets[0], i * sizeof(*fontsets));
+	} else {
+		frc = NULL;
+		frclen = frccap = 0;
+		xloadfonts(usedfont, size);
+		memmove(&fontsets[1], &fontsets[0], nfontsets * sizeof(*fontsets));
+		nfontsets++;
+	}
+	fontsets[0] = cur;
+
+	while (nfontsets > fontcachesize)
+		xunloadfontset(&fontsets[--nfontsets]);
+}
+
+/*
+ * Releases the memory left over by bursts of output: oversized terminal
+ * buffers, the fallback fonts not drawn since the last compaction, the
+ * images off the screen and the copy of the primary screen once back on it.
+ * The columns of the history wider than the window and the fonts of other
+ * sizes, bounded by fontcachesize anyway, are only dropped when asked with
+ * SIGUSR2 (report).
+ */
+void
+xcompact(int report)
+{
+	long rss = residentkib();
+	size_t freed = tcompact(report);
+	int i, j;
+
+	while (report && nfontsets > 0)
+		xunloadfontset(&fontsets[--nfontsets]);
+
+	for (i = 0; i < frclen && frc[i].used; i++)
+		;
+	if (i < frclen) {
+		if (xw.render == RENDER_SOFT)
+			rast_dropglyphs();
+#ifdef HARFBUZZ
+		hbunloadfonts();
+#endif
+	}
+	for (i = j = 0; i < frclen; i++) {
+		if (frc[i].used) {
+			frc[i].used = 0;
+			frc[j++] = frc[i];
+		} else {
+			XftFontClose(xw.dpy, frc[i].font);
+		}
+	}
+	frclen = j;
+
+	/* the copies of the primary screen kept after an alternate one */
+	if (!primarysaved) {
+		if (xw.primarybuf)
+			XFreePixmap(xw.dpy, xw.primarybuf);
+		xw.primarybuf = None;
+		if (xw.render == RENDER_SOFT)
+			freed += rast_dropsaved();
+	}
+
+	freed += gr_unload_offscreen_images();
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+
+	if (report) {
+		fprintf(stderr, "st: released %zu bytes", freed);
+		if (rss >= 0)
+			fprintf(stderr, ", resident size %ld -> %ld KiB",
+					rss, residentkib());
+		fputc('\n', stderr);
+	}
 }
 
 int
@@ -1225,6 +1799,31 @@ xinit(int cols, int rows)
 		die("can't open display\n");
 	xw.scr = XDefaultScreen(xw.dpy);
 	xw.vis = XDefaultVisual(xw.dpy, xw.scr);
+	xw.cmap = XDefaultColormap(xw.dpy, xw.scr);
+
+	/*
+	 * The shell needs WINDOWID, so the window is created first and sized
+	 * once the fonts are loaded. Meanwhile the shell starts up.
+	 */
+	xw.attrs.bit_gravity = NorthWestGravity;
+	xw.attrs.event_mask = FocusChangeMask | KeyPressMask | KeyReleaseMask
+		| ExposureMask | VisibilityChangeMask | StructureNotifyMask
+		| ButtonMotionMask | ButtonPressMask | ButtonReleaseMask;
+	xw.attrs.colormap = xw.cmap;
+
+	if (!(opt_embed && (parent = strtol(opt_embed, NULL, 0))))
+		parent = XRootWindow(xw.dpy, xw.scr);
+	xw.win = XCreateWindow(xw.dpy, parent, xw.l, xw.t, 1, 1, 0,
+			XDefaultDepth(xw.dpy, xw.scr), InputOutput, xw.vis,
+			CWBitGravity | CWEventMask | CWColormap, &xw.attrs);
+
+	fcntl(XConnectionNumber(xw.dpy), F_SETFD, FD_CLOEXEC);
+	xsetenv();
+	ttyfd = ttynew(opt_line, shell, opt_io, opt_cmd);
+	ttyresize(0, 0);
+#ifdef DRAWSTATS
+	spawnms = sincestart();
+#endif
 
 	/* font */
 	if (!FcInit())
@@ -1234,7 +1833,6 @@ xinit(int cols, int rows)
 	xloadfonts(usedfont, 0);
 
 	/* colors */
-	xw.cmap = XDefaultColormap(xw.dpy, xw.scr);
 	xloadcols();
 
 	/* adjust fixed window geometry */
@@ -1245,21 +1843,11 @@ xinit(int cols, int rows)
 	if (xw.gm & YNegative)
 		xw.t += DisplayHeight(xw.dpy, xw.scr) - win.h - 2;
 
-	/* Events */
 	xw.attrs.background_pixel = dc.col[defaultbg].pixel;
 	xw.attrs.border_pixel = dc.col[defaultbg].pixel;
-	xw.attrs.bit_gravity = NorthWestGravity;
-	xw.attrs.event_mask = FocusChangeMask | KeyPressMask | KeyReleaseMask
-		| ExposureMask | VisibilityChangeMask | StructureNotifyMask
-		| ButtonMotionMask | ButtonPressMask | ButtonReleaseMask;
-	xw.attrs.colormap = xw.cmap;
-
-	if (!(opt_embed && (parent = strtol(opt_embed, NULL, 0))))
-		parent = XRootWindow(xw.dpy, xw.scr);
-	xw.win = XCreateWindow(xw.dpy, parent, xw.l, xw.t,
-			win.w, win.h, 0, XDefaultDepth(xw.dpy, xw.scr), InputOutput,
-			xw.vis, CWBackPixel | CWBorderPixel | CWBitGravity
-			| CWEventMask | CWColormap, &xw.attrs);
+	XChangeWindowAttributes(xw.dpy, xw.win, CWBackPixel | CWBorderPixel,
+			&xw.attrs);
+	XMoveResizeWindow(xw.dpy, xw.win, xw.l, xw.t, win.w, win.h);
 
 	memset(&gcvalues, 0, sizeof(gcvalues));
 	gcvalues.graphics_exposures = False;
@@ -1271,11 +1859,30 @@ xinit(int cols, int rows)
 	XFillRectangle(xw.dpy, xw.buf, dc.gc, 0, 0, win.w, win.h);
 
 	/* font spec buffer */
-	xw.specbuf = xmalloc(cols * sizeof(GlyphFontSpec));
+	xw.specbuf = xmalloc(cols * CLUSTER_MAX * sizeof(GlyphFontSpec));
 
 	/* Xft rendering context */
 	xw.draw = XftDrawCreate(xw.dpy, xw.buf, xw.vis, xw.cmap);
 
+	/* renderer */
+	usedrender = (opt_render == NULL)? render : opt_render;
+	if (!strcmp(usedrender, "xrender")) {
+		xw.render = RENDER_XRENDER;
+		xcreatestrip();
+	} else if (!strcmp(usedrender, "soft")) {
+		if (rast_init(xw.dpy, xw.vis, DefaultDepth(xw.dpy, xw.scr),
+				xw.buf, dc.gc, win.w, win.h)) {
+			xw.render = RENDER_SOFT;
+			xclear(0, 0, win.w, win.h);
+		} else {
+			fprintf(stderr, "st: visual not supported by the soft "
+			                "renderer, using xft\n");
+		}
+	} else if (strcmp(usedrender, "xft")) {
+		die("unknown renderer '%s'\n", usedrender);
+	}
+	xcreatecursorbuf();
+
 	/* input methods */
 	if (!ximopen(xw.dpy)) {
 		XRegisterIMInstantiateCallback(xw.dpy, NULL, NULL, NULL,
@@ -1286,17 +1893,13 @@ xinit(int cols, int rows)
 	cursor = XCreateFontCursor(xw.dpy, mouseshape);
 	XDefineCursor(xw.dpy, xw.win, cursor);
 
-	if (XParseColor(xw.dpy, xw.cmap, colorname[mousefg], &xmousefg) == 0) {
-		xmousefg.red   = 0xffff;
-		xmousefg.green = 0xffff;
-		xmousefg.blue  = 0xffff;
-	}
-
-	if (XParseColor(xw.dpy, xw.cmap, colorname[mousebg], &xmousebg) == 0) {
-		xmousebg.red   = 0x0000;
-		xmousebg.green = 0x0000;
-		xmousebg.blue  = 0x0000;
-	}
+	/* already loaded with the palette */
+	xmousefg.red   = dc.col[mousefg].color.red;
+	xmousefg.green = dc.col[mousefg].color.green;
+	xmousefg.blue  = dc.col[mousefg].color.blue;
+	xmousebg.red   = dc.col[mousebg].color.red;
+	xmousebg.green = dc.col[mousebg].color.green;
+	xmousebg.blue  = dc.col[mousebg].color.blue;
 
 	XRecolorCursor(xw.dpy, cursor, &xmousefg, &xmousebg);
 
@@ -1312,6 +1915,7 @@ xinit(int cols, int rows)
 
 	win.mode = MODE_NUMLOCK;
 	resettitle();
+	flushprops();
 	xhints();
 	XMapWindow(xw.dpy, xw.win);
 	XSync(xw.dpy, False);
@@ -1324,12 +1928,36 @@ xinit(int cols, int rows)
 	if (xsel.xtarget == None)
 		xsel.xtarget = XA_STRING;
 
-	boxdraw_xinit(xw.dpy, xw.cmap, xw.draw, xw.vis);
+	boxdraw_xinit(xw.dpy, xw.cmap, xw.vis);
 
 	// Initialize the graphics (image display) module.
 	gr_init(xw.dpy, xw.vis, xw.cmap);
 }
 
+/* default ignorable marks that would only draw a missing glyph box */
+int
+isinvisible(Rune u)
+{
+	return u == 0x034F || BETWEEN(u, 0x200B, 0x200F) ||
+	       BETWEEN(u, 0x2060, 0x206F) || BETWEEN(u, 0xFE00, 0xFE0F) ||
+	       BETWEEN(u, 0xE0000, 0xE0FFF);
+}
+
+/* number of specs xmakeglyphfontspecs() emits for g */
+int
+glyphspecs(const Glyph *g)
+{
+	const Rune *runes;
+	int i, n, len;
+
+	if (!(g->mode & ATTR_COMBINING))
+		return 1;
+	runes = tgetcluster(g, &len);
+	for (i = n = 1; i < len; i++)
+		n += !isinvisible(runes[i]);
+	return n;
+}
+
 int
 xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x, int y)
 {
@@ -1339,21 +1967,24 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 	int frcflags = FRC_NORMAL;
 	float runewidth = win.cw;
 	Rune rune;
+	const Rune *runes;
 	FT_UInt glyphidx;
 	FcResult fcres;
 	FcPattern *fcpattern, *fontpattern;
 	FcFontSet *fcsets[] = { NULL };
 	FcCharSet *fccharset;
-	int i, f, numspecs = 0;
+	int i, r, nrunes, f, numspecs = 0;
 
-	for (i = 0, xp = winx, yp = winy + font->ascent; i < len; ++i) {
+	for (i = 0, xp = winx, yp = winy + font->ascent; i < len; ++i, xp += runewidth) {
 		/* Fetch rune and mode for current glyph. */
 		rune = glyphs[i].u;
 		mode = glyphs[i].mode;
 
 		/* Skip dummy wide-character spacing. */
-		if (mode == ATTR_WDUMMY)
+		if (mode == ATTR_WDUMMY) {
+			xp -= runewidth;
 			continue;
+		}
 
 		/* Draw spaces for image placeholders (images will be drawn
 		 * separately). */
@@ -1379,98 +2010,167 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 			yp = winy + font->ascent;
 		}
 
-		if (mode & ATTR_BOXDRAW) {
-			/* minor shoehorning: boxdraw uses only this ushort */
-			glyphidx = boxdrawindex(&glyphs[i]);
+		/* Marks of a grapheme cluster are drawn over the base rune. */
+		if (mode & ATTR_COMBINING) {
+			runes = tgetcluster(&glyphs[i], &nrunes);
 		} else {
-			/* Lookup character index with default font. */
-			glyphidx = XftCharIndex(xw.dpy, font->match, rune);
-		}
-		if (glyphidx) {
-			specs[numspecs].font = font->match;
-			specs[numspecs].glyph = glyphidx;
-			specs[numspecs].x = (short)xp;
-			specs[numspecs].y = (short)yp;
-			xp += runewidth;
-			numspecs++;
-			continue;
+			runes = &rune;
+			nrunes = 1;
 		}
 
-		/* Fallback on font cache, search the font cache for match. */
-		for (f = 0; f < frclen; f++) {
-			glyphidx = XftCharIndex(xw.dpy, frc[f].font, rune);
-			/* Everything correct. */
-			if (glyphidx && frc[f].flags == frcflags)
-				break;
-			/* We got a default font for a not found glyph. */
-			if (!glyphidx && frc[f].flags == frcflags
-					&& frc[f].unicodep == rune) {
-				break;
+		for (r = 0; r < nrunes; r++) {
+			rune = runes[r];
+			if (r > 0 && isinvisible(rune))
+				continue;
+
+			if (mode & ATTR_BOXDRAW) {
+				/* minor shoehorning: boxdraw uses only this ushort */
+				glyphidx = boxdrawindex(&glyphs[i]);
+			} else {
+				/* Lookup character index with default font. */
+				glyphidx = XftCharIndex(xw.dpy, font->match, rune);
+			}
+			if (glyphidx) {
+				specs[numspecs].font = font->match;
+				specs[numspecs].glyph = glyphidx;
+				specs[numspecs].x = (short)xp;
+				specs[numspecs].y = (short)yp;
+				numspecs++;
+				continue;
 			}
-		}
 
-		/* Nothing was found. Use fontconfig to find matching font. */
-		if (f >= frclen) {
-			if (!font->set)
-				font->set = FcFontSort(0, font->pattern,
-				                       1, 0, &fcres);
-			fcsets[0] = font->set;
+			/* Fallback on font cache, search the font cache for match. */
+			for (f = 0; f < frclen; f++) {
+				glyphidx = XftCharIndex(xw.dpy, frc[f].font, rune);
+				/* Everything correct. */
+				if (glyphidx && frc[f].flags == frcflags)
+					break;
+				/* We got a default font for a not found glyph. */
+				if (!glyphidx && frc[f].flags == frcflags
+						&& frc[f].unicodep == rune) {
+					break;
+				}
+			}
 
-			/*
-			 * Nothing was found in the cache. Now use
-			 * some dozen of Fontconfig calls to get the
-			 * font for one single character.
-			 *
-			 * Xft and fontconfig are design failures.
-			 */
-			fcpattern = FcPatternDuplicate(font->pattern);
-			fccharset = FcCharSetCreate();
+			/* Nothing was found. Use fontconfig to find matching font. */
+			if (f >= frclen) {
+				if (!font->set)
+					font->set = FcFontSort(0, font->pattern,
+					                       1, 0, &fcres);
+				fcsets[0] = font->set;
+
+				/*
+				 * Nothing was found in the cache. Now use
+				 * some dozen of Fontconfig calls to get the
+				 * font for one single character.
+				 *
+				 * Xft and fontconfig are design failures.
+				 */
+				fcpattern = FcPatternDuplicate(font->pattern);
+				fccharset = FcCharSetCreate();
+
+				FcCharSetAddChar(fccharset, rune);
+				FcPatternAddCharSet(fcpattern, FC_CHARSET,
+						fccharset);
+				FcPatternAddBool(fcpattern, FC_SCALABLE, 1);
+
+				FcConfigSubstitute(0, fcpattern,
+						FcMatchPattern);
+				FcDefaultSubstitute(fcpattern);
+
+				fontpattern = FcFontSetMatch(0, fcsets, 1,
+						fcpattern, &fcres);
+
+				/* Allocate memory for the new cache entry. */
+				if (frclen >= frccap) {
+					frccap += 16;
+					frc = xrealloc(frc, frccap * sizeof(Fontcache));
+				}
 
-			FcCharSetAddChar(fccharset, rune);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET,
-					fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, 1);
+				frc[frclen].font = XftFontOpenPattern(xw.dpy,
+						fontpattern);
+				if (!frc[frclen].font)
+					die("XftFontOpenPattern failed seeking fallback font: %s\n",
+						strerror(errno));
+				frc[frclen].flags = frcflags;
+				frc[frclen].unicodep = rune;
+				frc[frclen].used = 0;
 
-			FcConfigSubstitute(0, fcpattern,
-					FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
+				glyphidx = XftCharIndex(xw.dpy, frc[frclen].font, rune);
 
-			fontpattern = FcFontSetMatch(0, fcsets, 1,
-					fcpattern, &fcres);
+				f = frclen;
+				frclen++;
 
-			/* Allocate memory for the new cache entry. */
-			if (frclen >= frccap) {
-				frccap += 16;
-				frc = xrealloc(frc, frccap * sizeof(Fontcache));
+				FcPatternDestroy(fcpattern);
+				FcCharSetDestroy(fccharset);
 			}
 
-			frc[frclen].font = XftFontOpenPattern(xw.dpy,
-					fontpattern);
-			if (!frc[frclen].font)
-				die("XftFontOpenPattern failed seeking fallback font: %s\n",
-					strerror(errno));
-			frc[frclen].flags = frcflags;
-			frc[frclen].unicodep = rune;
+			frc[f].used = 1;
+			specs[numspecs].font = frc[f].font;
+			specs[numspecs].glyph = glyphidx;
+			specs[numspecs].x = (short)xp;
+			specs[numspecs].y = (short)yp;
+			numspecs++;
+		}
+	}
+#ifdef HARFBUZZ
+	if (len > 1)
+		xshapespecs(specs, glyphs, len);
+#endif
 
-			glyphidx = XftCharIndex(xw.dpy, frc[frclen].font, rune);
+	return numspecs;
+}
 
-			f = frclen;
-			frclen++;
+#ifdef HARFBUZZ
+/*
+ * Replaces the glyphs of runs of plain cells drawn with the same font by
+ * shaped ones. Clusters, box drawing and image placeholders are left alone.
+ */
+void
+xshapespecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len)
+{
+	static Rune *runes = NULL;
+	static FT_UInt *idx = NULL;
+	static short *xoff = NULL;
+	static int cap = 0;
+	const ushort unshaped = ATTR_COMBINING | ATTR_BOXDRAW | ATTR_IMAGE;
+	int i, k, n, s, start;
+
+	if (cap < len) {
+		cap = len;
+		runes = xrealloc(runes, cap * sizeof(*runes));
+		idx = xrealloc(idx, cap * sizeof(*idx));
+		xoff = xrealloc(xoff, cap * sizeof(*xoff));
+	}
 
-			FcPatternDestroy(fcpattern);
-			FcCharSetDestroy(fccharset);
+	for (i = s = 0; i < len;) {
+		if (glyphs[i].mode == ATTR_WDUMMY) {
+			i++;
+			continue;
+		}
+		if (glyphs[i].mode & unshaped) {
+			s += glyphspecs(&glyphs[i++]);
+			continue;
+		}
+		for (start = s, n = 0; i < len; i++) {
+			if (glyphs[i].mode == ATTR_WDUMMY)
+				continue;
+			if ((glyphs[i].mode & unshaped) ||
+					specs[s].font != specs[start].font)
+				break;
+			runes[n++] = glyphs[i].u;
+			s++;
+		}
+		if (n < 2)
+			continue;
+		hbshape(specs[start].font, runes, n, idx, xoff);
+		for (k = 0; k < n; k++) {
+			specs[start + k].glyph = idx[k];
+			specs[start + k].x += xoff[k];
 		}
-
-		specs[numspecs].font = frc[f].font;
-		specs[numspecs].glyph = glyphidx;
-		specs[numspecs].x = (short)xp;
-		specs[numspecs].y = (short)yp;
-		xp += runewidth;
-		numspecs++;
 	}
-
-	return numspecs;
 }
+#endif
 
 /* Draws a horizontal dashed line of length `w` starting at `(x, y)`. `wavelen`
  * is the length of the dash plus the length of the gap. `fraction` is the
@@ -1484,8 +2184,7 @@ xdrawunderdashed(Draw draw, Color *color, int x, int y, int w,
 		int startx = MAX(i, x);
 		int endx = MIN(i + dashw, x + w);
 		if (startx < endx)
-			XftDrawRect(xw.draw, color, startx, y, endx - startx,
-				    thick);
+			xdrawrect(color, startx, y, endx - startx, thick);
 	}
 }
 
@@ -1493,6 +2192,16 @@ xdrawunderdashed(Draw draw, Color *color, int x, int y, int w,
 static void
 xdrawundercurl(Draw draw, Color *color, int x, int y, int w, int h, int thick)
 {
+	if (xw.render != RENDER_XFT) {
+		/* the same 45 degree wave, traced column by column */
+		int segh = MAX(1, h - thick), wavelen = segh * 2;
+		for (int i = x; i < x + w; i++) {
+			int d = i % wavelen;
+			xdrawrect(color, i, y + MIN(d, wavelen - d), 1, thick);
+		}
+		return;
+	}
+
 	XGCValues gcvals = {.foreground = color->pixel,
 			    .line_width = thick,
 			    .line_style = LineSolid,
@@ -1522,50 +2231,47 @@ xdrawundercurl(Draw draw, Color *color, int x, int y, int w, int h, int thick)
 	XFreeGC(xw.dpy, gc);
 }
 
+/* Resolves the colors a run of cells with the attributes of base uses. */
 void
-xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, int y)
+xruncolors(Glyph *base, Color *fgout, Color *bgout)
 {
-	int charlen = len * ((base.mode & ATTR_WIDE) ? 2 : 1);
-	int winx = win.hborderpx + x * win.cw, winy = win.vborderpx + y * win.ch,
-	    width = charlen * win.cw;
 	Color *fg, *bg, *temp, revfg, revbg, truefg, truebg;
 	XRenderColor colfg, colbg;
-	XRectangle r;
 
 	/* Fallback on color display for attributes not supported by the font */
-	if (base.mode & ATTR_ITALIC && base.mode & ATTR_BOLD) {
+	if (base->mode & ATTR_ITALIC && base->mode & ATTR_BOLD) {
 		if (dc.ibfont.badslant || dc.ibfont.badweight)
-			base.fg = defaultattr;
-	} else if ((base.mode & ATTR_ITALIC && dc.ifont.badslant) ||
-	    (base.mode & ATTR_BOLD && dc.bfont.badweight)) {
-		base.fg = defaultattr;
+			base->fg = defaultattr;
+	} else if ((base->mode & ATTR_ITALIC && dc.ifont.badslant) ||
+	    (base->mode & ATTR_BOLD && dc.bfont.badweight)) {
+		base->fg = defaultattr;
 	}
 
-	if (IS_TRUECOL(base.fg)) {
+	if (IS_TRUECOL(base->fg)) {
 		colfg.alpha = 0xffff;
-		colfg.red = TRUERED(base.fg);
-		colfg.green = TRUEGREEN(base.fg);
-		colfg.blue = TRUEBLUE(base.fg);
+		colfg.red = TRUERED(base->fg);
+		colfg.green = TRUEGREEN(base->fg);
+		colfg.blue = TRUEBLUE(base->fg);
 		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colfg, &truefg);
 		fg = &truefg;
 	} else {
-		fg = &dc.col[base.fg];
+		fg = &dc.col[base->fg];
 	}
 
-	if (IS_TRUECOL(base.bg)) {
+	if (IS_TRUECOL(base->bg)) {
 		colbg.alpha = 0xffff;
-		colbg.green = TRUEGREEN(base.bg);
-		colbg.red = TRUERED(base.bg);
-		colbg.blue = TRUEBLUE(base.bg);
+		colbg.green = TRUEGREEN(base->bg);
+		colbg.red = TRUERED(base->bg);
+		colbg.blue = TRUEBLUE(base->bg);
 		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colbg, &truebg);
 		bg = &truebg;
 	} else {
-		bg = &dc.col[base.bg];
+		bg = &dc.col[base->bg];
 	}
 
 	/* Change basic system colors [0-7] to bright system colors [8-15] */
-	if ((base.mode & ATTR_BOLD_FAINT) == ATTR_BOLD && BETWEEN(base.fg, 0, 7))
-		fg = &dc.col[base.fg + 8];
+	if ((base->mode & ATTR_BOLD_FAINT) == ATTR_BOLD && BETWEEN(base->fg, 0, 7))
+		fg = &dc.col[base->fg + 8];
 
 	if (IS_SET(MODE_REVERSE)) {
 		if (fg == &dc.col[defaultfg]) {
@@ -1593,7 +2299,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 		}
 	}
 
-	if ((base.mode & ATTR_BOLD_FAINT) == ATTR_FAINT) {
+	if ((base->mode & ATTR_BOLD_FAINT) == ATTR_FAINT) {
 		colfg.red = fg->color.red / 2;
 		colfg.green = fg->color.green / 2;
 		colfg.blue = fg->color.blue / 2;
@@ -1602,18 +2308,30 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 		fg = &revfg;
 	}
 
-	if (base.mode & ATTR_REVERSE) {
+	if (base->mode & ATTR_REVERSE) {
 		temp = fg;
 		fg = bg;
 		bg = temp;
 	}
 
-	if (base.mode & ATTR_BLINK && win.mode & MODE_BLINK)
+	if (base->mode & ATTR_BLINK && win.mode & MODE_BLINK)
 		fg = bg;
 
-	if (base.mode & ATTR_INVISIBLE)
+	if (base->mode & ATTR_INVISIBLE)
 		fg = bg;
 
+	*fgout = *fg;
+	*bgout = *bg;
+}
+
+/* Clears the background of a run of cells and the borders next to it. */
+void
+xdrawbg(Color *bg, int x, int y, int width)
+{
+	int winx = win.hborderpx + x * win.cw, winy = win.vborderpx + y * win.ch;
+
+	fillphase = FILL_BG;
+
 	/* Intelligent cleaning up of the borders. */
 	if (x == 0) {
 		xclear(0, (y == 0)? 0 : winy, win.hborderpx,
@@ -1630,14 +2348,36 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 		xclear(winx, winy + win.ch, winx + width, win.h);
 
 	/* Clean up the region we want to draw to. */
-	XftDrawRect(xw.draw, bg, winx, winy, width, win.ch);
+	xdrawrect(bg, winx, winy, width, win.ch);
+}
+
+void
+xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len,
+                    int nglyphs, int x, int y)
+{
+	int charlen = nglyphs * ((base.mode & ATTR_WIDE) ? 2 : 1);
+	int winx = win.hborderpx + x * win.cw, winy = win.vborderpx + y * win.ch,
+	    width = charlen * win.cw;
+	Color fgc, bgc, *fg = &fgc, *bg = &bgc;
+	XRenderColor colfg;
+	XRectangle r;
+
+	xruncolors(&base, fg, bg);
+
+	/* The backgrounds of whole lines are drawn by xflushlines(). */
+	if (!linebgs)
+		xdrawbg(bg, x, y, width);
 
 	/* Set the clip region because Xft is sometimes dirty. */
 	r.x = 0;
 	r.y = 0;
 	r.height = win.ch;
 	r.width = width;
-	XftDrawSetClipRectangles(xw.draw, winx, winy, &r, 1);
+	if (xw.render == RENDER_XFT)
+		XftDrawSetClipRectangles(xw.draw, winx, winy, &r, 1);
+	else if (xw.render == RENDER_SOFT)
+		rast_setclip(winx, winy, width, win.ch);
+	fillphase = FILL_UNDER;
 
 	/* Decoration color. */
 	Color decor;
@@ -1675,9 +2415,9 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 		liney -= MAX(0, liney + thick - (winy + win.ch));
 		if (style == UNDERLINE_DOUBLE) {
 			liney -= MAX(0, liney + doubleh - (winy + win.ch));
-			XftDrawRect(xw.draw, &decor, winx, liney, width, thick);
-			XftDrawRect(xw.draw, &decor, winx,
-				    liney + doubleh - thick, width, thick);
+			xdrawrect(&decor, winx, liney, width, thick);
+			xdrawrect(&decor, winx, liney + doubleh - thick, width,
+				  thick);
 		} else if (style == UNDERLINE_DOTTED) {
 			xdrawunderdashed(xw.draw, &decor, winx, liney, width,
 					 thick * 2, 0.5, thick);
@@ -1690,37 +2430,52 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, Glyph base, int len, int x, i
 			xdrawundercurl(xw.draw, &decor, winx, liney, width,
 				       curlh, thick);
 		} else {
-			XftDrawRect(xw.draw, &decor, winx, liney, width, thick);
+			xdrawrect(&decor, winx, liney, width, thick);
 		}
 	}
 
+	fillphase = FILL_OVER;
+
 	if (base.mode & ATTR_BOXDRAW) {
 		/* Render the Box. */
-		drawboxes(winx, winy, width / len, win.ch, fg, bg, specs, len);
+		drawboxes(winx, winy, width / nglyphs, win.ch, fg, bg, specs, len);
 	} else {
 		/* Render the glyphs. */
-		XftDrawGlyphFontSpec(xw.draw, fg, specs, len);
+		if (xw.render == RENDER_XRENDER)
+			xbatchglyphs(fg, specs, len, winx, winy, width);
+		else if (xw.render == RENDER_SOFT)
+			rast_glyphs(fg, specs, len);
+		else
+			XftDrawGlyphFontSpec(xw.draw, fg, specs, len);
 	}
 
 	/* Render strikethrough. Alway use the fg color. */
 	if (base.mode & ATTR_STRUCK) {
-		XftDrawRect(xw.draw, fg, winx, winy + 2 * dc.font.ascent / 3,
-			    width, thick);
+		xdrawrect(fg, winx, winy + 2 * dc.font.ascent / 3, width,
+			  thick);
 	}
 
 	/* Reset clip to none. */
-	XftDrawSetClip(xw.draw, 0);
+	if (xw.render == RENDER_XFT)
+		XftDrawSetClip(xw.draw, 0);
+	else if (xw.render == RENDER_SOFT)
+		rast_unsetclip();
 }
 
 void
 xdrawglyph(Glyph g, int x, int y)
 {
 	int numspecs;
-	XftGlyphFontSpec spec;
+	XftGlyphFontSpec specs[CLUSTER_MAX];
 
-	numspecs = xmakeglyphfontspecs(&spec, &g, 1, x, y);
-	xdrawglyphfontspecs(&spec, g, numspecs, x, y);
+	numspecs = xmakeglyphfontspecs(specs, &g, 1, x, y);
+	xdrawglyphfontspecs(specs, g, numspecs, 1, x, y);
+	/* the cursor may be drawn over the same cell, keep the order */
+	if (xw.render == RENDER_XRENDER)
+		xflushbatch();
 	if (g.mode & ATTR_IMAGE) {
+		if (xw.render == RENDER_SOFT)
+			rast_present();
 		gr_start_drawing(xw.buf, win.cw, win.ch);
 		xdrawoneimagecell(g, x, y);
 		gr_finish_drawing(xw.buf);
@@ -1733,14 +2488,19 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 	Color drawcol;
 	XRenderColor colbg;
 
-	/* remove the old cursor */
-	if (selected(ox, oy))
-		og.mode ^= ATTR_REVERSE;
-	xdrawglyph(og, ox, oy);
+	/* xstartdraw() took the old cursor off, unless it has to be redrawn */
+	if (xw.render == RENDER_SOFT) {
+		if (selected(ox, oy))
+			og.mode ^= ATTR_REVERSE;
+		xdrawglyph(og, ox, oy);
+		xsavecursor(ox, oy, og.mode & ATTR_WIDE);
+	}
 
 	if (IS_SET(MODE_HIDE))
 		return;
 
+	xsavecursor(cx, cy, g.mode & ATTR_WIDE);
+
 	// If it's an image, just draw a ballot box for simplicity.
 	if (g.mode & ATTR_IMAGE)
 		g.u = 0x2610;
@@ -1748,7 +2508,8 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 	/*
 	 * Select the right color for the right mode.
 	 */
-	g.mode &= ATTR_BOLD|ATTR_ITALIC|ATTR_UNDERLINE|ATTR_STRUCK|ATTR_WIDE|ATTR_BOXDRAW;
+	g.mode &= ATTR_BOLD|ATTR_ITALIC|ATTR_UNDERLINE|ATTR_STRUCK|ATTR_WIDE|ATTR_BOXDRAW|
+	          ATTR_COMBINING;
 
 	if (IS_SET(MODE_REVERSE)) {
 		g.mode |= ATTR_REVERSE;
@@ -1800,7 +2561,7 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 			if (IS_SET(MODE_BLINK))
 					break;
 		case 4: /* Steady Underline */
-			XftDrawRect(xw.draw, &drawcol,
+			xdrawrect(&drawcol,
 					win.hborderpx + cx * win.cw,
 					win.vborderpx + (cy + 1) * win.ch - \
 					cursorthickness,
@@ -1810,7 +2571,7 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 			if (IS_SET(MODE_BLINK))
 					break;
 		case 6: /* Steady bar */
-			XftDrawRect(xw.draw, &drawcol,
+			xdrawrect(&drawcol,
 					win.hborderpx + cx * win.cw,
 					win.vborderpx + cy * win.ch,
 					cursorthickness, win.ch);
@@ -1823,19 +2584,19 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 			/* FALLTHROUGH */
 		}
 	} else {
-		XftDrawRect(xw.draw, &drawcol,
+		xdrawrect(&drawcol,
 				win.hborderpx + cx * win.cw,
 				win.vborderpx + cy * win.ch,
 				win.cw - 1, 1);
-		XftDrawRect(xw.draw, &drawcol,
+		xdrawrect(&drawcol,
 				win.hborderpx + cx * win.cw,
 				win.vborderpx + cy * win.ch,
 				1, win.ch - 1);
-		XftDrawRect(xw.draw, &drawcol,
+		xdrawrect(&drawcol,
 				win.hborderpx + (cx + 1) * win.cw - 1,
 				win.vborderpx + cy * win.ch,
 				1, win.ch - 1);
-		XftDrawRect(xw.draw, &drawcol,
+		xdrawrect(&drawcol,
 				win.hborderpx + cx * win.cw,
 				win.vborderpx + (cy + 1) * win.ch - 1,
 				win.cw, 1);
@@ -1967,6 +2728,8 @@ void xstartimagedraw(int *dirty, int rows) {
 
 /* Draw all queued image cells. */
 void xfinishimagedraw() {
+	/* Images are drawn on top of the text. */
+	xflushdraw();
 	gr_finish_drawing(xw.buf);
 }
 
@@ -1982,46 +2745,272 @@ xsetenv(void)
 void
 xseticontitle(char *p)
 {
-	XTextProperty prop;
 	DEFAULT(p, opt_title);
-
-	if (Xutf8TextListToTextProperty(xw.dpy, &p, 1, XUTF8StringStyle,
-	                                &prop) != Success)
-		return;
-	XSetWMIconName(xw.dpy, xw.win, &prop);
-	XSetTextProperty(xw.dpy, xw.win, &prop, xw.netwmiconname);
-	XFree(prop.value);
+	free(pendingicontitle);
+	pendingicontitle = xstrdup(p);
 }
 
 void
 xsettitle(char *p)
 {
-	XTextProperty prop;
 	DEFAULT(p, opt_title);
+	free(pendingtitle);
+	pendingtitle = xstrdup(p);
+}
+
+void
+xsettextprop(char *p, Atom netwmatom, int icon)
+{
+	XTextProperty prop;
 
 	if (Xutf8TextListToTextProperty(xw.dpy, &p, 1, XUTF8StringStyle,
 	                                &prop) != Success)
 		return;
-	XSetWMName(xw.dpy, xw.win, &prop);
-	XSetTextProperty(xw.dpy, xw.win, &prop, xw.netwmname);
+	if (icon)
+		XSetWMIconName(xw.dpy, xw.win, &prop);
+	else
+		XSetWMName(xw.dpy, xw.win, &prop);
+	XSetTextProperty(xw.dpy, xw.win, &prop, netwmatom);
 	XFree(prop.value);
 }
 
+void
+flushprops(void)
+{
+	if (pendingtitle) {
+		if (!title || strcmp(title, pendingtitle))
+			xsettextprop(pendingtitle, xw.netwmname, 0);
+		free(title);
+		title = pendingtitle;
+		pendingtitle = NULL;
+	}
+	if (pendingicontitle) {
+		if (!icontitle || strcmp(icontitle, pendingicontitle))
+			xsettextprop(pendingicontitle, xw.netwmiconname, 1);
+		free(icontitle);
+		icontitle = pendingicontitle;
+		pendingicontitle = NULL;
+	}
+	if (pendingurgent >= 0 && pendingurgent != urgent) {
+		XWMHints *h = XGetWMHints(xw.dpy, xw.win);
+
+		MODBIT(h->flags, pendingurgent, XUrgencyHint);
+		XSetWMHints(xw.dpy, xw.win, h);
+		XFree(h);
+		urgent = pendingurgent;
+	}
+	pendingurgent = -1;
+}
+
 int
 xstartdraw(void)
 {
-	return IS_SET(MODE_VISIBLE);
+	if (!IS_SET(MODE_VISIBLE))
+		return 0;
+
+	/* take the cursor off, xdrawcursor() draws it again */
+	if (cursorsaved) {
+		XCopyArea(xw.dpy, xw.cursorbuf, xw.buf, dc.gc, 0, 0,
+				cursorrect.width, cursorrect.height,
+				cursorrect.x, cursorrect.y);
+		cursorcells[ncursorcells++] = cursorrect;
+		cursorsaved = 0;
+	}
+	return 1;
+}
+
+/*
+ * Keeps xw.buf, which must show the whole primary screen, while the
+ * alternate screen is in use. Returns 0 if it cannot.
+ */
+int
+xsaveprimary(void)
+{
+	primarysaved = 0;
+	if (!IS_SET(MODE_VISIBLE))
+		return 0;
+
+	xflushdraw();
+	if (!xw.primarybuf) {
+		xw.primarybuf = XCreatePixmap(xw.dpy, xw.win, win.w, win.h,
+				DefaultDepth(xw.dpy, xw.scr));
+	}
+	XCopyArea(xw.dpy, xw.buf, xw.primarybuf, dc.gc, 0, 0, win.w, win.h,
+			0, 0);
+	if (xw.render == RENDER_SOFT)
+		rast_save();
+	primarysaved = 1;
+	return 1;
+}
+
+/*
+ * Puts back what xsaveprimary() kept, unless the size, the colors or the
+ * fonts changed since. Returns 0 if the screen must be drawn again.
+ */
+int
+xrestoreprimary(void)
+{
+	if (!primarysaved)
+		return 0;
+	primarysaved = 0;
+	if (xw.render == RENDER_SOFT && !rast_restore())
+		return 0;
+
+	XCopyArea(xw.dpy, xw.primarybuf, xw.buf, dc.gc, 0, 0, win.w, win.h,
+			0, 0);
+	/* the cursor layer saved pixels of the alternate screen */
+	cursorsaved = 0;
+	linesdrawn = 1;
+	return 1;
+}
+
+/*
+ * Moves the rows on xw.buf n rows down, for the view moved through the
+ * history, so that only the rows it uncovers are drawn again.
+ */
+void
+xscrollview(int n)
+{
+	int dy = n * win.ch, h = win.th - abs(dy), y = win.vborderpx;
+
+	if (dy > 0) {
+		XCopyArea(xw.dpy, xw.buf, xw.buf, dc.gc, 0, y, win.w, h,
+				0, y + dy);
+		if (xw.render == RENDER_SOFT)
+			rast_scroll(y, h, dy);
+	} else {
+		XCopyArea(xw.dpy, xw.buf, xw.buf, dc.gc, 0, y - dy, win.w, h,
+				0, y);
+		if (xw.render == RENDER_SOFT)
+			rast_scroll(y - dy, h, dy);
+	}
+	linesdrawn = 1;
+
+	if (scrollduration) {
+		scrollpx += dy;
+		if (abs(scrollpx) >= win.th)
+			scrollpx = 0;
+		scrolltotal = scrollpx;
+		scrollnew = 1;
+		clock_gettime(CLOCK_MONOTONIC, &scrollstart);
+	}
+}
+
+/* Presents one frame of the smooth scrolling, see scrollduration */
+void
+xscrollstep(void)
+{
+	struct timespec now;
+	double elapsed;
+	int px, d, y = win.vborderpx;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = TIMEDIFF(now, scrollstart);
+	px = elapsed >= scrollduration ? 0 :
+		scrolltotal * (1 - elapsed / scrollduration);
+	if (px == 0) {
+		scrollpx = 0;
+		XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w,
+				win.h, 0, 0);
+		return;
+	}
+	if (px == scrollpx)
+		return;
+
+	/* move what the window shows, then uncover the rest from xw.buf */
+	if (scrollpx > 0) {
+		d = scrollpx - px;
+		XCopyArea(xw.dpy, xw.win, xw.win, dc.gc, 0, y, win.w,
+				win.th - d, 0, y + d);
+		XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, y + px, win.w,
+				d, 0, y);
+	} else {
+		d = px - scrollpx;
+		XCopyArea(xw.dpy, xw.win, xw.win, dc.gc, 0, y + d, win.w,
+				win.th - d, 0, y);
+		XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, y + win.th - d + px,
+				win.w, d, 0, y + win.th - d);
+	}
+	scrollpx = px;
 }
 
 void
 xdrawline(Line line, int x1, int y1, int x2)
 {
-	int i, x, ox, numspecs;
+	if (nqlines == qlinescap) {
+		qlinescap += 16;
+		qlines = xrealloc(qlines, qlinescap * sizeof(*qlines));
+	}
+	qlines[nqlines++] = (QueuedLine){ line, x1, y1, x2 };
+}
+
+/*
+ * Draws the lines queued by xdrawline(). The backgrounds of all of them come
+ * first, so that same colored spans of neighbouring runs and rows are sent
+ * as a few large rectangles.
+ */
+void
+xflushlines(void)
+{
+	QueuedLine *l;
+
+	linesdrawn |= nqlines > 0;
+	fillinglines = 1;
+	for (l = qlines; l < &qlines[nqlines]; l++) {
+		xfillline(l->line, l->x1, l->y1, l->x2);
+		xbatchrow();
+	}
+	fillinglines = 0;
+	xflushbatch();
+
+	linebgs = 1;
+	for (l = qlines; l < &qlines[nqlines]; l++)
+		xdrawlineglyphs(l->line, l->x1, l->y1, l->x2);
+	linebgs = 0;
+	nqlines = 0;
+}
+
+/* Batches the backgrounds of a line, using the runs of xdrawlineglyphs(). */
+void
+xfillline(Line line, int x1, int y1, int x2)
+{
+	int x, ox, n;
+	Glyph base, new;
+	Color fg, bg;
+
+	for (x = x1, ox = n = 0; x <= x2; x++) {
+		if (x < x2) {
+			new = line[x];
+			if (new.mode == ATTR_WDUMMY)
+				continue;
+			if (selected(x, y1))
+				new.mode ^= ATTR_REVERSE;
+		}
+		if (n > 0 && (x == x2 || ATTRCMP(base, new))) {
+			xruncolors(&base, &fg, &bg);
+			xdrawbg(&bg, ox, y1, n * win.cw *
+					((base.mode & ATTR_WIDE) ? 2 : 1));
+			n = 0;
+		}
+		if (x == x2)
+			break;
+		if (n == 0) {
+			ox = x;
+			base = new;
+		}
+		n++;
+	}
+}
+
+void
+xdrawlineglyphs(Line line, int x1, int y1, int x2)
+{
+	int i, n, x, ox, numspecs;
 	Glyph base, new;
 	XftGlyphFontSpec *specs = xw.specbuf;
 
 	numspecs = xmakeglyphfontspecs(specs, &line[x1], x2 - x1, x1, y1);
-	i = ox = 0;
+	i = n = ox = 0;
 	for (x = x1; x < x2 && i < numspecs; x++) {
 		new = line[x];
 		if (new.mode == ATTR_WDUMMY)
@@ -2029,30 +3018,52 @@ xdrawline(Line line, int x1, int y1, int x2)
 		if (selected(x, y1))
 			new.mode ^= ATTR_REVERSE;
 		if (i > 0 && ATTRCMP(base, new)) {
-			xdrawglyphfontspecs(specs, base, i, ox, y1);
+			xdrawglyphfontspecs(specs, base, i, n, ox, y1);
 			if (base.mode & ATTR_IMAGE)
 				xdrawimages(base, line, ox, y1, x);
 			specs += i;
 			numspecs -= i;
-			i = 0;
+			i = n = 0;
 		}
 		if (i == 0) {
 			ox = x;
 			base = new;
 		}
-		i++;
+		i += glyphspecs(&new);
+		n++;
 	}
 	if (i > 0)
-		xdrawglyphfontspecs(specs, base, i, ox, y1);
+		xdrawglyphfontspecs(specs, base, i, n, ox, y1);
 	if (i > 0 && base.mode & ATTR_IMAGE)
 		xdrawimages(base, line, ox, y1, x);
+	if (xw.render == RENDER_XRENDER)
+		xflushbatch();
 }
 
 void
 xfinishdraw(void)
 {
-	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w,
-			win.h, 0, 0);
+	int i;
+
+	xflushdraw();
+	if (scrollpx && (scrollnew || !linesdrawn)) {
+		xscrollstep();
+	} else if (linesdrawn || scrollpx) {
+		scrollpx = 0;
+		XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w,
+				win.h, 0, 0);
+	} else {
+		/* only the cursor moved or blinked */
+		for (i = 0; i < ncursorcells; i++) {
+			XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc,
+					cursorcells[i].x, cursorcells[i].y,
+					cursorcells[i].width, cursorcells[i].height,
+					cursorcells[i].x, cursorcells[i].y);
+		}
+	}
+	linesdrawn = 0;
+	ncursorcells = 0;
+	scrollnew = 0;
 	XSetForeground(xw.dpy, dc.gc,
 			dc.col[IS_SET(MODE_REVERSE)?
 				defaultfg : defaultbg].pixel);
@@ -2102,8 +3113,10 @@ xsetmode(int set, unsigned int flags)
 {
 	int mode = win.mode;
 	MODBIT(win.mode, set, flags);
-	if ((win.mode & MODE_REVERSE) != (mode & MODE_REVERSE))
+	if ((win.mode & MODE_REVERSE) != (mode & MODE_REVERSE)) {
+		primarysaved = 0;
 		redraw();
+	}
 }
 
 int
@@ -2121,11 +3134,7 @@ xsetcursor(int cursor)
 void
 xseturgency(int add)
 {
-	XWMHints *h = XGetWMHints(xw.dpy, xw.win);
-
-	MODBIT(h->flags, add, XUrgencyHint);
-	XSetWMHints(xw.dpy, xw.win, h);
-	XFree(h);
+	pendingurgent = add;
 }
 
 void
@@ -2287,15 +3296,80 @@ resize(XEvent *e)
 	cresize(e->xconfigure.width, e->xconfigure.height);
 }
 
+/* resident set size in KiB, -1 where it cannot be read */
+long
+residentkib(void)
+{
+	FILE *f;
+	long pages;
+
+	if (!(f = fopen("/proc/self/statm", "r")))
+		return -1;
+	if (fscanf(f, "%*s %ld", &pages) != 1)
+		pages = -1;
+	fclose(f);
+	return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void
+sigcompact(int sig)
+{
+	compactrequest = 1;
+}
+
+#ifdef DRAWSTATS
+void
+sigdrawstats(int sig)
+{
+	statsrequest = 1;
+}
+
+double
+sincestart(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return TIMEDIFF(now, starttime);
+}
+
+int
+cmpdouble(const void *a, const void *b)
+{
+	double d = *(const double *)a - *(const double *)b;
+
+	return (d > 0) - (d < 0);
+}
+
+void
+drawstats(void)
+{
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < ndraws; i++)
+		sum += drawtimes[i];
+	qsort(drawtimes, ndraws, sizeof(*drawtimes), cmpdouble);
+	fprintf(stderr, "frames %d draw mean %.3f ms p99 %.3f ms"
+	        " requests/frame %.1f wall %.3f s"
+	        " (shell %.1f ms map %.1f ms prompt %.1f ms)\n", ndraws,
+	        ndraws ? sum / ndraws : 0,
+	        ndraws ? drawtimes[(ndraws - 1) * 99 / 100] : 0,
+	        ndraws ? (double)drawrequests / ndraws : 0,
+	        sincestart() / 1E3, spawnms, mapms, promptms);
+}
+#endif
+
 void
 run(void)
 {
 	XEvent ev;
 	int w = win.w, h = win.h;
 	fd_set rfd;
-	int xfd = XConnectionNumber(xw.dpy), ttyfd, xev, drawing;
-	struct timespec seltv, *tv, now, lastblink, trigger;
-	double timeout;
+	int xfd = XConnectionNumber(xw.dpy), xev, drawing;
+	struct timespec seltv, *tv, now, lastblink, trigger, lastactive;
+	double timeout, idle;
+	int compacted = 0, predictms;
 
 	/* Waiting for window mapping */
 	do {
@@ -2312,17 +3386,32 @@ run(void)
 			h = ev.xconfigure.height;
 		}
 	} while (ev.type != MapNotify);
+#ifdef DRAWSTATS
+	mapms = sincestart();
+#endif
 
-	ttyfd = ttynew(opt_line, shell, opt_io, opt_cmd);
 	cresize(w, h);
+	signal(SIGUSR2, sigcompact);
+#ifdef DRAWSTATS
+	signal(SIGTERM, sigdrawstats);
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &lastactive);
 
 	for (timeout = -1, drawing = 0, lastblink = (struct timespec){0};;) {
 		FD_ZERO(&rfd);
 		FD_SET(ttyfd, &rfd);
 		FD_SET(xfd, &rfd);
 
-		if (XPending(xw.dpy))
+		if (XPending(xw.dpy) || compactrequest)
 			timeout = 0;  /* existing events might not set xfd */
+#ifdef DRAWSTATS
+		if (statsrequest)
+			timeout = 0;
+#endif
+
+		/* Keep presenting frames while smooth scrolling. */
+		if (scrollpx && IS_SET(MODE_VISIBLE))
+			timeout = timeout < 0 ? 1E3 / 60 : MIN(timeout, 1E3 / 60);
 
 		/* Decrease the timeout if there are active animations. */
 		if (graphics_next_redraw_delay != INT_MAX &&
@@ -2342,8 +3431,12 @@ run(void)
 		}
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
-		if (FD_ISSET(ttyfd, &rfd))
+		if (FD_ISSET(ttyfd, &rfd)) {
 			ttyread();
+#ifdef DRAWSTATS
+			outputseen = 1;
+#endif
+		}
 
 		xev = 0;
 		while (XPending(xw.dpy)) {
@@ -2367,6 +3460,8 @@ run(void)
 		 * sync with periodic updates from animations/key-repeats/etc.
 		 */
 		if (FD_ISSET(ttyfd, &rfd) || xev) {
+			lastactive = now;
+			compacted = 0;
 			if (!drawing) {
 				trigger = now;
 				if (IS_SET(MODE_BLINK)) {
@@ -2394,10 +3489,53 @@ run(void)
 				timeout = blinktimeout;
 			}
 		}
-
+		if ((predictms = tpredictexpire()) >= 0)
+			timeout = timeout < 0 ? predictms : MIN(timeout, predictms);
+
+		flushmotion();
+		flushprops();
+#ifdef DRAWSTATS
+		{
+			unsigned long req = NextRequest(xw.dpy);
+			struct timespec t0, t1;
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			draw();
+			XFlush(xw.dpy);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			if (ndraws >= drawscap) {
+				drawscap = drawscap ? drawscap * 2 : 1024;
+				drawtimes = xrealloc(drawtimes,
+				                     drawscap * sizeof(*drawtimes));
+			}
+			drawtimes[ndraws++] = TIMEDIFF(t1, t0);
+			drawrequests += NextRequest(xw.dpy) - req;
+			if (outputseen && promptms < 0)
+				promptms = sincestart();
+		}
+		/* the workload is over once its output has been drawn */
+		if (statsrequest && !FD_ISSET(ttyfd, &rfd)) {
+			drawstats();
+			exit(0);
+		}
+#else
 		draw();
 		XFlush(xw.dpy);
+#endif
 		drawing = 0;
+
+		/* give memory back once idle, or when asked with SIGUSR2 */
+		idle = TIMEDIFF(now, lastactive);
+		if (compactrequest || (compacttimeout && !compacted &&
+		    idle >= compacttimeout * 1E3)) {
+			xcompact(compactrequest);
+			compactrequest = 0;
+			compacted = 1;
+		}
+		if (compacttimeout && !compacted) {
+			idle = compacttimeout * 1E3 - idle;
+			timeout = timeout < 0 ? idle : MIN(timeout, idle);
+		}
 	}
 }
 
@@ -2406,17 +3544,20 @@ usage(void)
 {
 	die("usage: %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid]"
+	    "          [-r renderer] [-T title] [-t title] [-w windowid]"
 	    " [[-e] command [args ...]]\n"
 	    "       %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid] -l line"
-	    " [stty_args ...]\n", argv0, argv0);
+	    "          [-r renderer] [-T title] [-t title] [-w windowid]"
+	    " -l line [stty_args ...]\n", argv0, argv0);
 }
 
 int
 main(int argc, char *argv[])
 {
+#ifdef DRAWSTATS
+	clock_gettime(CLOCK_MONOTONIC, &starttime);
+#endif
 	xw.l = xw.t = 0;
 	xw.isfixed = False;
 	xsetcursor(cursorshape);
@@ -2445,6 +3586,9 @@ main(int argc, char *argv[])
 	case 'o':
 		opt_io = EARGF(usage());
 		break;
+	case 'r':
+		opt_render = EARGF(usage());
+		break;
 	case 'l':
 		opt_line = EARGF(usage());
 		break;
@@ -2478,7 +3622,6 @@ run:
 	rows = MAX(rows, 1);
 	tnew(cols, rows);
 	xinit(cols, rows);
-	xsetenv();
 	selinit();
 	run();
 